@@ -0,0 +1,136 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+enum class OverflowPolicy {
+    DROP_OLDEST, // evict the oldest entry to make room
+    DROP_NEWEST, // reject the entry being pushed
+    BLOCK        // wait for the consumer to make room
+};
+
+// fixed capacity ring buffer between two pipeline stages. keeps memory and
+// latency bounded when the consumer falls behind the producer
+template <typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity = 8, OverflowPolicy policy = OverflowPolicy::DROP_OLDEST) {
+        configure(capacity, policy);
+    }
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // drops anything queued and resets the counters, call before the
+    // pipeline starts
+    void configure(size_t capacity, OverflowPolicy policy) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.clear();
+        slots_.resize(capacity > 0 ? capacity : 1);
+        policy_ = policy;
+        head_ = 0;
+        count_ = 0;
+        high_water_ = 0;
+        closed_ = false;
+        dropped_.store(0);
+    }
+
+    // returns false if the pushed item was rejected, by DROP_NEWEST or by
+    // close() while blocked. DROP_OLDEST always returns true
+    bool push(T item) {
+        { std::unique_lock<std::mutex> lock(mutex_);
+            if (count_ == slots_.size()) {
+                switch (policy_) {
+                case OverflowPolicy::DROP_OLDEST:
+                    head_ = (head_ + 1) % slots_.size();
+                    --count_;
+                    dropped_.fetch_add(1);
+                    break;
+                case OverflowPolicy::DROP_NEWEST:
+                    dropped_.fetch_add(1);
+                    return false;
+                case OverflowPolicy::BLOCK:
+                    not_full_cv_.wait(lock, [this] { return count_ < slots_.size() || closed_; });
+                    if (closed_) return false;
+                    break;
+                }
+            }
+            slots_[(head_ + count_) % slots_.size()] = std::move(item);
+            ++count_;
+            if (count_ > high_water_) high_water_ = count_;
+        }
+        not_empty_cv_.notify_one();
+        return true;
+    }
+
+    // waits for an entry or for wake() to become true. returns false when
+    // woken without an entry
+    template <typename Predicate>
+    bool wait_pop(T& out, Predicate wake) {
+        { std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_cv_.wait(lock, [&] { return count_ > 0 || closed_ || wake(); });
+            if (count_ == 0) return false;
+
+            out = std::move(slots_[head_]);
+            slots_[head_] = T(); // release the slot's resources now, not on overwrite
+            head_ = (head_ + 1) % slots_.size();
+            --count_;
+        }
+        not_full_cv_.notify_one();
+        return true;
+    }
+
+    bool try_pop(T& out) {
+        return wait_pop(out, [] { return true; });
+    }
+
+    // wakes waiters so they re-check their wake predicate
+    void notify() {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        not_empty_cv_.notify_all();
+        not_full_cv_.notify_all();
+    }
+
+    // releases blocked producers and consumers for shutdown
+    void close() {
+        { std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_empty_cv_.notify_all();
+        not_full_cv_.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return slots_.size();
+    }
+
+    size_t high_water() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return high_water_;
+    }
+
+    uint64_t dropped() const { return dropped_.load(); }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_cv_;
+    std::condition_variable not_full_cv_;
+    std::vector<T> slots_;
+    OverflowPolicy policy_ = OverflowPolicy::DROP_OLDEST;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t high_water_ = 0;
+    bool closed_ = false;
+    std::atomic<uint64_t> dropped_{0};
+};
+
+#endif
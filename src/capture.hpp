@@ -0,0 +1,172 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#include "media_pipeline.hpp"
+#include "packet_ring.hpp"
+#include "video_encoder.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+struct CaptureParams {
+    int width = 1920;                // camera mode, what passthrough recordings are made at
+    int height = 1080;
+    int fps = 20;
+    int analysis_width = 1280;       // bgr frames for detection and streaming
+    int analysis_height = 720;
+    int analysis_fps = 20;
+    bool passthrough = true;         // tee an encoded branch off the camera for recording, hardware encoders only
+    bool software_passthrough = false; // allow x264enc for the branch. it then encodes 1080p around the
+                                       // clock, competing with detection while nothing is recorded
+    EncoderParams encoder;
+};
+
+// camera capture as one gstreamer graph. the analysis branch is scaled,
+// rate limited and converted to bgr for read(). with passthrough the camera
+// is also tee'd into an h.264 encoder whose access units go straight into a
+// PacketRing, so recording never decodes or re-encodes anything
+class CapturePipeline {
+public:
+    CapturePipeline() : pipeline_("capture") {}
+    CapturePipeline(const CapturePipeline&) = delete;
+    CapturePipeline& operator=(const CapturePipeline&) = delete;
+    ~CapturePipeline() { close(); }
+
+    // falls back to analysis only when the encoded branch can't be built.
+    // the raw stream then jpeg encodes every frame into the pre-record ring
+    // all the time, and recording decodes and x264 encodes those jpegs
+    bool open(const CaptureParams& params, PacketRing& ring) {
+        close();
+        params_ = params;
+        ring_ = &ring;
+        if (params.passthrough) {
+            const bool hardware = params.encoder.prefer_hardware && has_gst_element("v4l2h264enc");
+            if (hardware && launch(true, true)) encoder_ = "v4l2h264enc";
+            else if (params.software_passthrough && launch(true, false)) encoder_ = "x264enc";
+            if (passthrough_) {
+                std::cout << "[capture] info: passthrough recording with " << encoder_ << ".\n";
+                return true;
+            }
+            if (!hardware && !params.software_passthrough) {
+                std::cout << "[capture] info: no hardware h.264 encoder, recording will re-encode analysis frames.\n";
+            } else {
+                std::cerr << "[capture] warning: no encoded branch, recording will re-encode analysis frames.\n";
+            }
+        }
+        return launch(false, false);
+    }
+
+    bool passthrough() const { return passthrough_; }
+    cv::Size analysis_size() const { return cv::Size(params_.analysis_width, params_.analysis_height); }
+
+    // copies the next analysis frame into frame. false on timeout or failure
+    bool read(cv::Mat& frame, std::chrono::milliseconds timeout) {
+        if (!analysis_ || pipeline_.failed()) return false;
+        GstSample* sample = gst_app_sink_try_pull_sample(GST_APP_SINK(analysis_), timeout.count() * GST_MSECOND);
+        if (!sample) return false;
+
+        GstBuffer* buffer = gst_sample_get_buffer(sample);
+        GstMapInfo map;
+        const bool mapped = buffer && gst_buffer_map(buffer, &map, GST_MAP_READ);
+        if (mapped) {
+            // gstreamer pads raw rows to 4 bytes
+            const int w = params_.analysis_width;
+            const int h = params_.analysis_height;
+            const size_t stride = (static_cast<size_t>(w) * 3 + 3) & ~static_cast<size_t>(3);
+            if (map.size >= stride * h) {
+                frame.create(h, w, CV_8UC3);
+                for (int y = 0; y < h; ++y) std::memcpy(frame.ptr(y), map.data + y * stride, static_cast<size_t>(w) * 3);
+            }
+            gst_buffer_unmap(buffer, &map);
+        }
+        gst_sample_unref(sample);
+        return mapped && !frame.empty();
+    }
+
+    void close() {
+        running_.store(false);
+        if (encoded_thread_.joinable()) encoded_thread_.join();
+        if (analysis_) gst_object_unref(analysis_);
+        if (encoded_) gst_object_unref(encoded_);
+        analysis_ = nullptr;
+        encoded_ = nullptr;
+        passthrough_ = false;
+        pipeline_.stop();
+    }
+
+private:
+    bool launch(bool passthrough, bool hardware) {
+        const std::string camera =
+            "libcamerasrc ! video/x-raw,width=" + std::to_string(params_.width) + ",height=" + std::to_string(params_.height) +
+            ",framerate=" + std::to_string(params_.fps) + "/1";
+        // rate is limited before scaling so dropped frames cost nothing
+        const std::string analysis =
+            "queue leaky=downstream max-size-buffers=2 ! "
+            "videorate drop-only=true ! video/x-raw,framerate=" + std::to_string(params_.analysis_fps) + "/1 ! "
+            "videoscale ! videoconvert ! "
+            "video/x-raw,format=BGR,width=" + std::to_string(params_.analysis_width) + ",height=" + std::to_string(params_.analysis_height) + " ! "
+            "appsink name=analysis sync=false max-buffers=1 drop=true";
+        const std::string encoded =
+            "queue leaky=downstream max-size-buffers=8 ! "
+            "videoconvert ! video/x-raw,format=I420 ! " + h264_encoder_description(params_.encoder, params_.fps, hardware) + " ! "
+            "h264parse config-interval=-1 ! video/x-h264,stream-format=byte-stream,alignment=au ! "
+            "appsink name=encoded sync=false max-buffers=64 drop=false";
+
+        const std::string description = passthrough
+            ? camera + " ! tee name=t t. ! " + analysis + " t. ! " + encoded
+            : camera + " ! " + analysis;
+        if (!pipeline_.launch(description)) return false;
+        analysis_ = pipeline_.element("analysis");
+        if (passthrough) encoded_ = pipeline_.element("encoded");
+        if (!pipeline_.start()) {
+            close();
+            return false;
+        }
+
+        passthrough_ = passthrough;
+        if (passthrough) {
+            running_.store(true);
+            encoded_thread_ = std::thread(&CapturePipeline::drain_encoded, this);
+        }
+        return true;
+    }
+
+    // moves encoded access units into the ring as they come out
+    void drain_encoded() {
+        while (running_.load()) {
+            GstSample* sample = gst_app_sink_try_pull_sample(GST_APP_SINK(encoded_), 100 * GST_MSECOND);
+            if (!sample) {
+                if (gst_app_sink_is_eos(GST_APP_SINK(encoded_))) break;
+                continue;
+            }
+            GstBuffer* buffer = gst_sample_get_buffer(sample);
+            GstMapInfo map;
+            if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+                const bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+                ring_->push(map.data, map.size, GST_BUFFER_PTS(buffer), keyframe, std::chrono::steady_clock::now());
+                gst_buffer_unmap(buffer, &map);
+            }
+            gst_sample_unref(sample);
+        }
+    }
+
+    CaptureParams params_;
+    PacketRing* ring_ = nullptr;
+    MediaPipeline pipeline_;
+    GstElement* analysis_ = nullptr;
+    GstElement* encoded_ = nullptr;
+    std::string encoder_;
+    bool passthrough_ = false;
+    std::atomic<bool> running_{false};
+    std::thread encoded_thread_;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class FramePool;
+
+struct FrameSlot {
+    cv::Mat mat;
+    std::atomic<int> refs{0};
+    FramePool* pool = nullptr; // null when allocated outside the pool
+};
+
+// refcounted handle to a pooled frame. the frame is filled once by whoever
+// acquired it and is read-only after that, so handles can be shared between
+// threads without copying. the buffer goes back to the pool with the last handle.
+class FrameHandle {
+public:
+    FrameHandle() = default;
+    FrameHandle(const FrameHandle& other) : slot_(other.slot_) { retain(); }
+    FrameHandle(FrameHandle&& other) noexcept : slot_(other.slot_) { other.slot_ = nullptr; }
+    ~FrameHandle() { release(); }
+
+    FrameHandle& operator=(const FrameHandle& other) {
+        if (slot_ != other.slot_) {
+            release();
+            slot_ = other.slot_;
+            retain();
+        }
+        return *this;
+    }
+    FrameHandle& operator=(FrameHandle&& other) noexcept {
+        if (this != &other) {
+            release();
+            slot_ = other.slot_;
+            other.slot_ = nullptr;
+        }
+        return *this;
+    }
+
+    const cv::Mat& mat() const {
+        static const cv::Mat empty_mat;
+        return slot_ ? slot_->mat : empty_mat;
+    }
+
+    // only valid before the handle is shared
+    cv::Mat& writable() { return slot_->mat; }
+
+    bool empty() const { return !slot_ || slot_->mat.empty(); }
+    void reset() { release(); }
+
+private:
+    friend class FramePool;
+    explicit FrameHandle(FrameSlot* slot) : slot_(slot) { retain(); }
+
+    inline void retain();
+    inline void release();
+
+    FrameSlot* slot_ = nullptr;
+};
+
+// fixed set of preallocated frame buffers recycled between captures, so the
+// capture loop does no heap allocation once every slot has been handed out once
+class FramePool {
+public:
+    FramePool() = default;
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    void reserve(size_t capacity, cv::Size size, int type) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.reserve(slots_.size() + capacity);
+        free_.reserve(free_.size() + capacity);
+        for (size_t i = 0; i < capacity; ++i) {
+            auto slot = std::make_unique<FrameSlot>();
+            slot->mat.create(size, type);
+            slot->pool = this;
+            free_.push_back(slot.get());
+            slots_.push_back(std::move(slot));
+        }
+    }
+
+    // hands out a free buffer. when every buffer is still referenced, falls back
+    // to a one-off allocation so capture never stalls on slow consumers
+    FrameHandle acquire() {
+        { std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                FrameSlot* slot = free_.back();
+                free_.pop_back();
+                return FrameHandle(slot);
+            }
+        }
+        overflow_count_.fetch_add(1);
+        return FrameHandle(new FrameSlot());
+    }
+
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return slots_.size();
+    }
+
+    size_t available() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+    uint64_t overflow_count() const { return overflow_count_.load(); }
+
+private:
+    friend class FrameHandle;
+
+    void recycle(FrameSlot* slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(slot);
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<FrameSlot>> slots_;
+    std::vector<FrameSlot*> free_;
+    std::atomic<uint64_t> overflow_count_{0};
+};
+
+inline void FrameHandle::retain() {
+    if (slot_) slot_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void FrameHandle::release() {
+    if (!slot_) return;
+    if (slot_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (slot_->pool) {
+            slot_->pool->recycle(slot_);
+        } else {
+            delete slot_;
+        }
+    }
+    slot_ = nullptr;
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef GALLERY_HPP
+#define GALLERY_HPP
+
+#include "types.hpp"
+#include "simd.hpp"
+#include "ivf_index.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct GalleryMatch {
+    size_t index;
+    float score; // cosine similarity, embeddings are normalized
+};
+
+// fixed capacity block of aligned row-major embeddings, allocated once.
+// snapshots share chunks and the writer only fills rows past what any
+// published snapshot can see, so readers never observe a row being written
+struct GalleryChunk {
+    static constexpr size_t ROWS = 1024;
+
+    explicit GalleryChunk(size_t stride) : data(ROWS * stride, 0.f), names(ROWS) {}
+
+    std::vector<float, AlignedAllocator<float>> data;
+    std::vector<std::string> names;
+    size_t filled = 0; // rows written so far, only touched by the writer
+};
+
+// immutable, versioned snapshot of every enrolled embedding. a search streams
+// contiguous chunks instead of chasing one heap block per entry. new entries
+// go into a new snapshot through appended(), which shares all existing rows,
+// so enrollment costs O(new entries) and never disturbs running searches
+class Gallery {
+public:
+    Gallery() = default;
+
+    explicit Gallery(const std::vector<EmbeddingEntry>& entries, const IvfParams& params = IvfParams()) : params_(params) {
+        append_rows(entries);
+        update_index();
+    }
+
+    // returns the next version with entries added. writers must be serialized
+    // and should extend the latest snapshot, an older one gets its tail copied
+    std::shared_ptr<const Gallery> appended(const std::vector<EmbeddingEntry>& entries) const {
+        auto next = std::make_shared<Gallery>(*this);
+        next->version_ = version_ + 1;
+
+        const size_t first = next->size_;
+        next->append_rows(entries);
+        if (next->index_.trained()) {
+            next->index_.insert(*next, first, next->size_);
+        } else {
+            next->update_index();
+        }
+        return next;
+    }
+
+    uint64_t version() const { return version_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t dim() const { return dim_; }
+    bool indexed() const { return index_.trained(); }
+
+    const std::string& name(size_t i) const {
+        return chunks_[i / GalleryChunk::ROWS]->names[i % GalleryChunk::ROWS];
+    }
+    const float* row(size_t i) const {
+        return chunks_[i / GalleryChunk::ROWS]->data.data() + (i % GalleryChunk::ROWS) * stride_;
+    }
+
+    // k most similar rows to one probe, best first. approximate once indexed
+    void search(const float* probe, size_t k, std::vector<GalleryMatch>& out) const {
+        out.clear();
+        if (empty()) return;
+
+        if (index_.trained()) {
+            index_.search(*this, probe, k, params_, out);
+            return;
+        }
+
+        thread_local std::vector<float> scores;
+        scores.resize(GalleryChunk::ROWS);
+        for (size_t c = 0; c < chunks_.size(); ++c) {
+            const size_t rows = chunk_rows(c);
+            simd::gemv(chunks_[c]->data.data(), rows, stride_, probe, dim_, scores.data());
+            accumulate_top_k(scores.data(), rows, c * GalleryChunk::ROWS, k, out);
+        }
+    }
+
+    // k most similar rows to each of count row-major probes, best first
+    void search_batch(const float* probes, size_t count, size_t probe_stride, size_t k, std::vector<std::vector<GalleryMatch>>& out) const {
+        if (out.size() < count) out.resize(count);
+        for (size_t p = 0; p < count; ++p) out[p].clear();
+        if (empty() || count == 0) return;
+
+        if (index_.trained()) {
+            for (size_t p = 0; p < count; ++p) {
+                index_.search(*this, probes + p * probe_stride, k, params_, out[p]);
+            }
+            return;
+        }
+
+        thread_local std::vector<float> scores;
+        scores.resize(count * GalleryChunk::ROWS);
+        for (size_t c = 0; c < chunks_.size(); ++c) {
+            const size_t rows = chunk_rows(c);
+            simd::gemm(chunks_[c]->data.data(), rows, stride_, probes, count, probe_stride, dim_, scores.data());
+            for (size_t p = 0; p < count; ++p) {
+                accumulate_top_k(scores.data() + p * rows, rows, c * GalleryChunk::ROWS, k, out[p]);
+            }
+        }
+    }
+
+private:
+    // rows start on a 64 byte boundary
+    static size_t padded(size_t dim) { return (dim + 15) / 16 * 16; }
+
+    size_t chunk_rows(size_t c) const {
+        return std::min(GalleryChunk::ROWS, size_ - c * GalleryChunk::ROWS);
+    }
+
+    void append_rows(const std::vector<EmbeddingEntry>& entries) {
+        for (const EmbeddingEntry& entry : entries) {
+            const size_t dim = entry.embedding.size();
+            if (dim_ == 0) {
+                dim_ = dim;
+                stride_ = padded(dim);
+            }
+            if (dim != dim_) {
+                std::cerr << "[gallery] warning: skipping " << entry.name << ", embedding size " << dim << " != " << dim_ << ".\n";
+                continue;
+            }
+
+            const size_t slot = size_ % GalleryChunk::ROWS;
+            if (slot == 0) {
+                chunks_.push_back(std::make_shared<GalleryChunk>(stride_));
+            } else if (chunks_.back()->filled != slot) {
+                // another snapshot already wrote past our tail, fork the chunk
+                auto fork = std::make_shared<GalleryChunk>(*chunks_.back());
+                fork->filled = slot;
+                chunks_.back() = fork;
+            }
+
+            GalleryChunk& chunk = *chunks_.back();
+            std::copy(entry.embedding.begin(), entry.embedding.end(), chunk.data.begin() + slot * stride_);
+            chunk.names[slot] = entry.name;
+            chunk.filled = slot + 1;
+            ++size_;
+        }
+    }
+
+    // the index is trained once the gallery crosses params_.min_rows
+    void update_index() {
+        if (index_.trained() || size_ < params_.min_rows) return;
+        index_.build(*this, size_, stride_, dim_, params_);
+        std::cout << "[gallery] info: indexed " << size_ << " embeddings into " << index_.list_count() << " lists.\n";
+    }
+
+    // merges n scores into a small sorted top k list, k is a handful at most
+    static void accumulate_top_k(const float* scores, size_t n, size_t base, size_t k, std::vector<GalleryMatch>& out) {
+        if (k == 0) return;
+        for (size_t i = 0; i < n; ++i) {
+            if (out.size() == k && scores[i] <= out.back().score) continue;
+            if (out.size() < k) out.push_back({ base + i, scores[i] });
+            else out.back() = { base + i, scores[i] };
+            for (size_t j = out.size() - 1; j > 0 && out[j].score > out[j - 1].score; --j) {
+                std::swap(out[j], out[j - 1]);
+            }
+        }
+    }
+
+    std::vector<std::shared_ptr<GalleryChunk>> chunks_;
+    size_t size_ = 0;
+    size_t dim_ = 0;
+    size_t stride_ = 0;
+    uint64_t version_ = 0;
+    IvfParams params_;
+    IvfIndex index_;
+};
+
+#endif
@@ -2,35 +2,79 @@
 
 ncnn::Net g_retinaface_net;
 ncnn::Net g_mobilefacenet_net;
+RetinaFaceDetector g_retinaface_detector;
 
 std::atomic<int> g_frame_count(0);
 std::atomic<int> g_fps(0);
-std::atomic<bool> g_should_record(false);
-std::atomic<bool> g_should_reload_db(false);
 
 std::atomic<bool> g_exit_fps_thread(false);
 std::atomic<bool> g_exit_server_thread(false);
 std::atomic<bool> g_exit_db_thread(false);
-std::atomic<bool> g_exit_recording_thread(false);
-std::atomic<bool> g_exit_detection_thread(false);
-std::atomic<bool> g_exit_embedding_thread(false);
+std::atomic<bool> g_exit_storage_thread(false);
 std::atomic<bool> g_exit_main_thread(false);
 
-cv::Mat g_frame;
+Scheduler g_scheduler;
+
+// must be defined before any global holding a FrameHandle
+FramePool g_frame_pool;
+
+FrameHandle g_frame;
+uint64_t g_frame_seq = 0;
+uint64_t g_frame_dispatched_seq = 0;
+uint64_t g_detection_ticket = 0;
 std::mutex g_frame_mutex;
 
-cv::Mat g_streaming_buffer;
+std::atomic<uint64_t> g_detections_run(0);
+std::atomic<uint64_t> g_detections_skipped(0);
+std::atomic<int> g_detections_in_flight(0);
+std::atomic<uint64_t> g_detections_motion_skipped(0);
+std::atomic<uint64_t> g_detections_tracked(0);
+std::atomic<uint64_t> g_roi_tiles_run(0);
+std::atomic<bool> g_faces_in_view(false);
+std::atomic<uint64_t> g_last_detection_seq(0);
+
+std::atomic<uint64_t> g_embeddings_run(0);
+std::atomic<uint64_t> g_embeddings_cached(0);
+
+MotionDetector g_motion_detector;
+
+FrameHandle g_streaming_buffer;
+std::chrono::steady_clock::time_point g_streaming_buffer_time;
 std::mutex g_streaming_buffer_mutex;
 
-cv::Mat g_annotated_streaming_buffer;
+DetectionResult g_annotated_streaming_buffer;
 std::mutex g_annotated_streaming_buffer_mutex;
 
-std::queue<FrameEntry> g_recording_buffer;
-std::mutex g_recording_buffer_mutex;
+std::shared_ptr<const EncodedFrame> g_raw_jpeg;
+std::shared_ptr<const EncodedFrame> g_annotated_jpeg;
+std::mutex g_jpeg_mutex;
+std::condition_variable g_jpeg_cv;
+std::atomic<int> g_raw_viewers(0);
+std::atomic<int> g_annotated_viewers(0);
+
+std::atomic<uint64_t> g_recording_encode_latency_us(0);
+std::atomic<uint64_t> g_recording_bitrate_kbps(0);
+std::atomic<uint64_t> g_recording_frames_dropped(0);
+std::atomic<uint64_t> g_recording_gaps(0);
+std::atomic<uint64_t> g_recording_packets_lost(0);
+RecordingTrigger g_recording_trigger;
+PacketRing g_encoded_ring;
+PacketRing g_jpeg_ring;
+BoundedQueue<StorageChunk> g_storage_queue;
+std::atomic<uint64_t> g_storage_bytes_written(0);
+std::atomic<uint64_t> g_storage_segments(0);
+std::atomic<uint64_t> g_storage_errors(0);
+std::atomic<uint64_t> g_storage_max_write_ms(0);
+std::atomic<bool> g_storage_direct_io(false);
+std::atomic<bool> g_capture_passthrough(false);
+
+ReorderBuffer<DetectionResult> g_detection_reorder;
+
+BoundedQueue<DetectionResult> g_embedding_buffer;
 
-std::queue<DetectionResult> g_embedding_buffer;
-std::mutex g_embedding_buffer_mutex;
-std::condition_variable g_embedding_buffer_cv;
+std::shared_ptr<const Gallery> g_gallery;
+std::atomic<uint64_t> g_gallery_version(0);
+std::mutex g_gallery_writer_mutex;
 
 std::unordered_map<std::string, std::chrono::time_point<std::chrono::steady_clock>> g_valid_sessions;
 std::mutex g_valid_sessions_mutex;
@@ -5,8 +5,19 @@
 #include <net.h>
 
 #include "types.hpp"
+#include "bounded_queue.hpp"
+#include "reorder_buffer.hpp"
+#include "gallery.hpp"
+#include "scheduler.hpp"
+#include "motion.hpp"
+#include "retinaface.hpp"
+#include "packet_ring.hpp"
+#include "recording_trigger.hpp"
+#include "segment_file.hpp"
 
 #include <atomic>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
@@ -26,36 +37,86 @@ static const std::array<cv::Point2f, 5> g_EMBEDDING_REFERENCE = {
 
 extern ncnn::Net g_retinaface_net;
 extern ncnn::Net g_mobilefacenet_net;
+extern RetinaFaceDetector g_retinaface_detector;        // anchor grids shared by detection tasks
 
 extern std::atomic<int> g_frame_count;
 extern std::atomic<int> g_fps;
-extern std::atomic<bool> g_should_record;
-extern std::atomic<bool> g_should_reload_db;
 
 extern std::atomic<bool> g_exit_fps_thread;
 extern std::atomic<bool> g_exit_server_thread;
 extern std::atomic<bool> g_exit_db_thread;
-extern std::atomic<bool> g_exit_recording_thread;
-extern std::atomic<bool> g_exit_detection_thread;
-extern std::atomic<bool> g_exit_embedding_thread;
+extern std::atomic<bool> g_exit_storage_thread;
 extern std::atomic<bool> g_exit_main_thread;
 
-extern cv::Mat g_frame;
+extern Scheduler g_scheduler;                          // runs detection, embedding and broadcast tasks
+
+extern FramePool g_frame_pool;                         // write: main
+
+extern FrameHandle g_frame;                            // read: detection
+extern uint64_t g_frame_seq;                           // write: main
+extern uint64_t g_frame_dispatched_seq;                // last g_frame_seq claimed by a detection task
+extern uint64_t g_detection_ticket;                    // next ticket handed to a detection task
 extern std::mutex g_frame_mutex;
 
-extern cv::Mat g_streaming_buffer;                     // read: server
+extern std::atomic<uint64_t> g_detections_run;
+extern std::atomic<uint64_t> g_detections_skipped;
+extern std::atomic<int> g_detections_in_flight;
+extern std::atomic<uint64_t> g_detections_motion_skipped;
+extern std::atomic<uint64_t> g_detections_tracked;     // frames the tracker covered instead of the detector
+extern std::atomic<uint64_t> g_roi_tiles_run;          // full resolution tiles detected on
+extern std::atomic<bool> g_faces_in_view;             // last detection found a face
+extern std::atomic<uint64_t> g_last_detection_seq;     // g_frame_seq of the last detector run
+
+extern std::atomic<uint64_t> g_embeddings_run;
+extern std::atomic<uint64_t> g_embeddings_cached;      // detected faces that reused their track's identity
+
+extern MotionDetector g_motion_detector;               // write: detection
+
+extern FrameHandle g_streaming_buffer;                 // read: broadcast
+extern std::chrono::steady_clock::time_point g_streaming_buffer_time; // when it was captured
 extern std::mutex g_streaming_buffer_mutex;            // write: main
 
-extern cv::Mat g_annotated_streaming_buffer;           // read: server
+extern DetectionResult g_annotated_streaming_buffer;   // read: broadcast
 extern std::mutex g_annotated_streaming_buffer_mutex;  // write: embedding
 
-// recording thread
-extern std::queue<FrameEntry> g_recording_buffer;      // read: recording
-extern std::mutex g_recording_buffer_mutex;            // write: main
+// broadcast tasks
+extern std::shared_ptr<const EncodedFrame> g_raw_jpeg;       // read: server
+extern std::shared_ptr<const EncodedFrame> g_annotated_jpeg; // write: broadcast
+extern std::mutex g_jpeg_mutex;
+extern std::condition_variable g_jpeg_cv;
+extern std::atomic<int> g_raw_viewers;
+extern std::atomic<int> g_annotated_viewers;
 
-extern std::queue<DetectionResult> g_embedding_buffer; // read: embedding
-extern std::mutex g_embedding_buffer_mutex;            // write: detection
-extern std::condition_variable g_embedding_buffer_cv;
+// recording thread
+extern std::atomic<uint64_t> g_recording_encode_latency_us; // mean over the current recording
+extern std::atomic<uint64_t> g_recording_bitrate_kbps;
+extern std::atomic<uint64_t> g_recording_frames_dropped;    // encoder too far behind
+extern std::atomic<uint64_t> g_recording_gaps;              // times the recorder fell behind its ring
+extern std::atomic<uint64_t> g_recording_packets_lost;      // evicted unread, or undecodable after a gap
+extern RecordingTrigger g_recording_trigger;           // read: recording
+                                                       // write: main, embedding, stopped by main
+extern PacketRing g_encoded_ring;                      // read: recording
+                                                       // write: capture
+extern PacketRing g_jpeg_ring;                         // read: recording
+                                                       // write: broadcast
+extern BoundedQueue<StorageChunk> g_storage_queue;     // read: storage
+                                                       // write: recording muxers
+extern std::atomic<uint64_t> g_storage_bytes_written;  // closed segments only
+extern std::atomic<uint64_t> g_storage_segments;
+extern std::atomic<uint64_t> g_storage_errors;         // failed opens, writes and fsyncs
+extern std::atomic<uint64_t> g_storage_max_write_ms;   // slowest single block write
+extern std::atomic<bool> g_storage_direct_io;
+extern std::atomic<bool> g_capture_passthrough;        // recording reads g_encoded_ring, not g_jpeg_ring
+
+extern ReorderBuffer<DetectionResult> g_detection_reorder; // write: detection
+
+extern BoundedQueue<DetectionResult> g_embedding_buffer; // read: embedding
+                                                         // write: detection
+
+// read: embedding, server (gallery_snapshot)
+extern std::shared_ptr<const Gallery> g_gallery;       // write: embedding, server
+extern std::atomic<uint64_t> g_gallery_version;         // bumped on every publish
+extern std::mutex g_gallery_writer_mutex;
 
                                                        // read: server
 extern std::unordered_map<std::string, std::chrono::time_point<std::chrono::steady_clock>> g_valid_sessions;
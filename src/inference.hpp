@@ -0,0 +1,42 @@
+#ifndef INFERENCE_HPP
+#define INFERENCE_HPP
+
+#include <net.h>
+#include <allocator.h>
+
+// long lived inference state for one thread, or one serial stage. the
+// extractor keeps its blob and workspace pools between runs, so once a
+// full-size input has gone through every later run reuses pooled memory
+// instead of going back to the heap
+class InferenceContext {
+public:
+    explicit InferenceContext(const ncnn::Net& net, int num_threads = 0) : extractor_(net.create_extractor()) {
+        extractor_.set_light_mode(true);
+        if (num_threads > 0) extractor_.set_num_threads(num_threads);
+        extractor_.set_blob_allocator(&blob_allocator_);
+        extractor_.set_workspace_allocator(&workspace_allocator_);
+    }
+    InferenceContext(const InferenceContext&) = delete;
+    InferenceContext& operator=(const InferenceContext&) = delete;
+
+    // the extractor, ready for a new input. blobs from the previous run go
+    // back to the pools
+    ncnn::Extractor& begin() {
+        extractor_.clear();
+        return extractor_;
+    }
+
+    // input blobs should come from here so they are pooled as well
+    ncnn::Allocator* blob_allocator() { return &blob_allocator_; }
+
+    // persistent input blob for callers that fill it in place
+    ncnn::Mat input;
+
+private:
+    // declared before the extractor so its blobs are released first
+    ncnn::PoolAllocator blob_allocator_;                 // blobs can outlive a run, keep it locked
+    ncnn::UnlockedPoolAllocator workspace_allocator_;    // scratch for a single layer, never shared
+    ncnn::Extractor extractor_;
+};
+
+#endif
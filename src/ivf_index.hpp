@@ -0,0 +1,194 @@
+#ifndef IVF_INDEX_HPP
+#define IVF_INDEX_HPP
+
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+struct IvfParams {
+    size_t min_rows = 2048;      // below this an exhaustive scan is already fast, don't index
+    size_t rows_per_list = 128;  // number of lists = rows / rows_per_list when trained
+    size_t nprobe = 8;           // lists scanned per query, higher = better recall, slower
+    size_t rerank = 32;          // approximate candidates re-scored exactly in float
+    size_t max_train_rows = 65536;
+    int train_iterations = 8;
+};
+
+// inverted file index over normalized embeddings. rows are bucketed under
+// their nearest spherical k-means centroid and stored as int8 codes, a query
+// scans the nprobe closest buckets then re-ranks the best candidates against
+// the exact float rows. the index only stores row ids, the float rows are
+// read through a Rows type with a row(id) accessor.
+// copies share centroids and untouched lists, so inserting into a copy only
+// duplicates the lists that change
+class IvfIndex {
+public:
+    bool trained() const { return !lists_.empty(); }
+    size_t list_count() const { return lists_.size(); }
+
+    // trains centroids on the first count rows and indexes all of them
+    template <typename Rows>
+    void build(const Rows& rows, size_t count, size_t stride, size_t dim, const IvfParams& params) {
+        lists_.clear();
+        centroids_.reset();
+        dim_ = dim;
+        stride_ = stride;
+        if (count == 0) return;
+        const size_t nlist = std::max<size_t>(1, count / std::max<size_t>(1, params.rows_per_list));
+
+        // seed centroids with evenly spaced rows
+        auto centroids = std::make_shared<std::vector<float, AlignedAllocator<float>>>(nlist * stride_, 0.f);
+        for (size_t c = 0; c < nlist; ++c) {
+            const float* row = rows.row(c * count / nlist);
+            std::copy(row, row + dim_, centroids->begin() + c * stride_);
+        }
+        centroids_ = centroids;
+
+        // spherical k-means on a subsample
+        const size_t train_step = std::max<size_t>(1, count / std::max<size_t>(1, params.max_train_rows));
+        std::vector<float> sums(nlist * dim_);
+        std::vector<size_t> counts(nlist);
+        for (int it = 0; it < params.train_iterations; ++it) {
+            std::fill(sums.begin(), sums.end(), 0.f);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (size_t r = 0; r < count; r += train_step) {
+                const float* row = rows.row(r);
+                size_t c = nearest_centroid(row, nlist);
+                float* sum = sums.data() + c * dim_;
+                for (size_t k = 0; k < dim_; ++k) sum[k] += row[k];
+                ++counts[c];
+            }
+            for (size_t c = 0; c < nlist; ++c) {
+                if (counts[c] == 0) continue; // keep the old centroid for empty clusters
+                const float* sum = sums.data() + c * dim_;
+                float norm = std::sqrt(simd::dot(sum, sum, dim_));
+                if (norm <= 0.f) continue;
+                float* centroid = centroids->data() + c * stride_;
+                for (size_t k = 0; k < dim_; ++k) centroid[k] = sum[k] / norm;
+            }
+        }
+
+        std::vector<std::shared_ptr<InvertedList>> lists(nlist);
+        for (auto& list : lists) list = std::make_shared<InvertedList>();
+        for (size_t r = 0; r < count; ++r) {
+            append_to(*lists[nearest_centroid(rows.row(r), nlist)], rows.row(r), static_cast<uint32_t>(r));
+        }
+        lists_.assign(lists.begin(), lists.end());
+    }
+
+    // adds rows [first, last) to their nearest lists without retraining.
+    // lists shared with other copies of the index are copied before writing
+    template <typename Rows>
+    void insert(const Rows& rows, size_t first, size_t last) {
+        if (!trained()) return;
+        std::vector<std::shared_ptr<InvertedList>> copied(lists_.size());
+        for (size_t r = first; r < last; ++r) {
+            size_t c = nearest_centroid(rows.row(r), lists_.size());
+            if (!copied[c]) {
+                copied[c] = std::make_shared<InvertedList>(*lists_[c]);
+                lists_[c] = copied[c];
+            }
+            append_to(*copied[c], rows.row(r), static_cast<uint32_t>(r));
+        }
+    }
+
+    // top k ids by exact similarity among the candidates found in the nprobe
+    // nearest lists
+    template <typename Rows, typename Match>
+    void search(const Rows& rows, const float* probe, size_t k, const IvfParams& params, std::vector<Match>& out) const {
+        out.clear();
+        if (!trained() || k == 0) return;
+
+        thread_local std::vector<float> centroid_scores;
+        thread_local std::vector<uint32_t> probe_lists;
+        thread_local std::vector<int8_t> probe_code;
+        thread_local std::vector<std::pair<int32_t, uint32_t>> candidates;
+
+        // pick the closest lists
+        const size_t nlist = lists_.size();
+        centroid_scores.resize(nlist);
+        simd::gemv(centroids_->data(), nlist, stride_, probe, dim_, centroid_scores.data());
+        const size_t nprobe = std::min(std::max<size_t>(1, params.nprobe), nlist);
+        probe_lists.resize(nlist);
+        for (size_t c = 0; c < nlist; ++c) probe_lists[c] = static_cast<uint32_t>(c);
+        std::partial_sort(probe_lists.begin(), probe_lists.begin() + nprobe, probe_lists.end(),
+            [](uint32_t a, uint32_t b) { return centroid_scores[a] > centroid_scores[b]; });
+
+        // approximate scores on int8 codes, keep the best rerank candidates in a min heap
+        probe_code.resize(dim_);
+        quantize(probe, probe_code.data());
+        const size_t keep = std::max(k, params.rerank);
+        candidates.clear();
+        auto worse = [](const std::pair<int32_t, uint32_t>& a, const std::pair<int32_t, uint32_t>& b) { return a.first > b.first; };
+        for (size_t p = 0; p < nprobe; ++p) {
+            const InvertedList& list = *lists_[probe_lists[p]];
+            for (size_t i = 0; i < list.ids.size(); ++i) {
+                int32_t score = simd::dot_i8(list.codes.data() + i * dim_, probe_code.data(), dim_);
+                if (candidates.size() < keep) {
+                    candidates.emplace_back(score, list.ids[i]);
+                    std::push_heap(candidates.begin(), candidates.end(), worse);
+                } else if (score > candidates.front().first) {
+                    std::pop_heap(candidates.begin(), candidates.end(), worse);
+                    candidates.back() = { score, list.ids[i] };
+                    std::push_heap(candidates.begin(), candidates.end(), worse);
+                }
+            }
+        }
+
+        // exact re-rank
+        out.reserve(candidates.size());
+        for (const auto& candidate : candidates) {
+            out.push_back({ candidate.second, simd::dot(rows.row(candidate.second), probe, dim_) });
+        }
+        std::sort(out.begin(), out.end(), [](const Match& a, const Match& b) { return a.score > b.score; });
+        if (out.size() > k) out.resize(k);
+    }
+
+private:
+    struct InvertedList {
+        std::vector<int8_t> codes; // dim bytes per row
+        std::vector<uint32_t> ids;
+    };
+
+    size_t nearest_centroid(const float* row, size_t nlist) const {
+        size_t best = 0;
+        float best_score = -2.f;
+        for (size_t c = 0; c < nlist; ++c) {
+            float score = simd::dot(centroids_->data() + c * stride_, row, dim_);
+            if (score > best_score) {
+                best_score = score;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    void append_to(InvertedList& list, const float* row, uint32_t id) const {
+        size_t offset = list.codes.size();
+        list.codes.resize(offset + dim_);
+        quantize(row, list.codes.data() + offset);
+        list.ids.push_back(id);
+    }
+
+    // components of a normalized 128-d embedding sit well inside +-0.4,
+    // the rare outlier is clamped and fixed up by the exact re-rank
+    void quantize(const float* row, int8_t* code) const {
+        const float scale = 127.f / 0.4f;
+        for (size_t k = 0; k < dim_; ++k) {
+            float v = std::round(row[k] * scale);
+            code[k] = static_cast<int8_t>(std::max(-127.f, std::min(127.f, v)));
+        }
+    }
+
+    size_t dim_ = 0;
+    size_t stride_ = 0;
+    std::shared_ptr<const std::vector<float, AlignedAllocator<float>>> centroids_;
+    std::vector<std::shared_ptr<const InvertedList>> lists_;
+};
+
+#endif
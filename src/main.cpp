@@ -1,17 +1,22 @@
 #include <opencv2/opencv.hpp>
 
 #include "utils.hpp"
+#include "capture.hpp"
+#include "precision.hpp"
 #include "threads/fps.hpp"
 #include "threads/server.hpp"
 #include "threads/db.hpp"
 #include "threads/recording.hpp"
+#include "threads/storage.hpp"
 #include "threads/detection.hpp"
 #include "threads/embedding.hpp"
+#include "threads/broadcast.hpp"
 
 #include <iostream>
 #include <chrono>
 #include <string>
 #include <thread>
+#include <algorithm>
 #include <mutex>
 #include <csignal>
 
@@ -25,22 +30,71 @@ void signal_handler(int signum) {
 int main() {
     const float target_fps = 20; // sets a maximum fps
 
+    // detection -> embedding hand-off, each entry pins a full resolution frame
+    const size_t embedding_queue_capacity = 4;
+    const OverflowPolicy embedding_queue_policy = OverflowPolicy::DROP_OLDEST;
+
+    // detection, embedding and stream encoding run as tasks on one worker per
+    // core. up to max_in_flight frames are detected concurrently and the cores
+    // are split between them so ncnn doesn't oversubscribe the cpu
+    const int cpu_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    DetectionParams detection_params;
+    detection_params.max_in_flight = std::max(1, cpu_count / 2);
+    detection_params.threads_per_task = std::max(1, cpu_count / detection_params.max_in_flight);
+    detection_params.interval = 5; // tracked faces are re-detected 4 times a second at 20 fps
+
+    // network precision, overridable with SECURITY_VIEW_RETINAFACE_PRECISION and
+    // SECURITY_VIEW_MOBILEFACENET_PRECISION (fp32, fp16 or int8). both stay
+    // fp32 until tools/precision_report has been run on the target and shows
+    // detection recall and the match threshold hold
+    const Precision default_retinaface_precision = Precision::FP32;
+    const Precision default_mobilefacenet_precision = Precision::FP32;
+
+    // detection only runs on frames with motion, plus a keyframe every second
+    MotionParams motion_params;
+    motion_params.keyframe_interval = std::chrono::milliseconds(1000);
+
+    // with a hardware h.264 encoder the camera's 1080p stream is encoded once
+    // and recorded as is. without one (the pi 5) every 720p frame is jpeg
+    // encoded around the clock to fill the pre-record ring, viewers or not,
+    // and recording adds a jpeg decode plus x264 encode per frame on top.
+    // detection and streaming get 720p bgr frames either way
+    CaptureParams capture_params;
+    capture_params.fps = static_cast<int>(target_fps);
+    capture_params.analysis_fps = static_cast<int>(target_fps);
+
+    // record once someone has been in view for a second, until they have
+    // been gone for two, starting two seconds before they showed up
+    RecordingParams recording_params;
+    recording_params.activate_time = std::chrono::milliseconds(1000);
+    recording_params.deactivate_time = std::chrono::milliseconds(2000);
+    recording_params.preroll = std::chrono::milliseconds(2000);
+    g_recording_trigger.configure(recording_params);
+
+    // pre-event history is held compressed in fixed budgets. the encoded ring
+    // has to reach back past the pre-roll, the activation delay and one gop
+    // to find a keyframe, with headroom for bitrate overshoot. the jpeg ring
+    // only fills when there is no encoded branch, 720p jpegs run ~100 KiB
+    const std::chrono::milliseconds prerecord_history =
+        recording_params.preroll + recording_params.activate_time + capture_params.encoder.keyframe_interval;
+    const size_t prerecord_packets = static_cast<size_t>(target_fps * prerecord_history.count() / 1000) * 2;
+    const size_t encoded_ring_budget = static_cast<size_t>(capture_params.encoder.bitrate_kbps) * 1000 / 8 * prerecord_history.count() / 1000 * 3 / 2;
+    const size_t jpeg_ring_budget = 64ull << 20;
+
     // build video capture device
-    std::string pipeline =
-        "libcamerasrc ! "
-        "videoconvert ! "
-        "video/x-raw,format=BGR ! "
-        "appsink sync=false max-buffers=1 drop=true";
-    cv::VideoCapture video_capture(pipeline, cv::CAP_GSTREAMER);
-    if (!video_capture.isOpened()) {
+    g_encoded_ring.configure(encoded_ring_budget, prerecord_packets);
+    CapturePipeline video_capture;
+    if (!video_capture.open(capture_params, g_encoded_ring)) {
         std::cerr << "[main] error: could not open camera." << std::endl;
         return -1;
     }
+    g_capture_passthrough.store(video_capture.passthrough());
+    if (!video_capture.passthrough()) g_jpeg_ring.configure(jpeg_ring_budget, prerecord_packets);
     std::cout << "[main] info: opened camera.\n";
 
     // define capture info
-    const uint32_t frame_width = static_cast<int>(video_capture.get(cv::CAP_PROP_FRAME_WIDTH));
-    const uint32_t frame_height = static_cast<int>(video_capture.get(cv::CAP_PROP_FRAME_HEIGHT));
+    const uint32_t frame_width = video_capture.analysis_size().width;
+    const uint32_t frame_height = video_capture.analysis_size().height;
 
     // fps calculations
     const std::chrono::milliseconds target_frame_duration(1000 / (int)target_fps);
@@ -53,43 +107,62 @@ int main() {
     // init networks
     std::cout << "[main] info: found " << ncnn::get_gpu_count() << " gpus.\n";
 
-    g_retinaface_net.opt.use_vulkan_compute = true;
-    g_retinaface_net.opt.num_threads = 4;
     // https://github.com/nihui/ncnn-assets/tree/master/models
-    if (g_retinaface_net.load_param("models/retinaface/mnet.25-opt.param") != 0 ||
-            g_retinaface_net.load_model("models/retinaface/mnet.25-opt.bin") != 0) {
+    Precision retinaface_precision = precision_from_env("SECURITY_VIEW_RETINAFACE_PRECISION", default_retinaface_precision);
+    if (!load_net(g_retinaface_net, "models/retinaface/mnet.25-opt", retinaface_precision, 4)) {
         std::cerr << "[main] error: failed to load RetinaFace model." << std::endl;
         return 0;
     }
-    std::cout << "[main] info: RetinaFace model loaded successfully.\n";
+    std::cout << "[main] info: RetinaFace model loaded successfully (" << precision_name(retinaface_precision) << ").\n";
+
+    // anchor grids for letterboxed frames and full size roi tiles
+    const RetinaFaceConfig& retinaface_config = g_retinaface_detector.config();
+    const cv::Size detection_input = letterbox_size(frame_width, frame_height, retinaface_config.target_size, retinaface_config.align);
+    g_retinaface_detector.prepare(detection_input.width, detection_input.height);
+    g_retinaface_detector.prepare(detection_params.roi.tile_size, detection_params.roi.tile_size);
 
-    g_mobilefacenet_net.opt.use_vulkan_compute = true;
-    g_mobilefacenet_net.opt.num_threads = 4;
     // https://github.com/liguiyuan/mobilefacenet-ncnn/tree/master/models
-    if (g_mobilefacenet_net.load_param("models/mobilefacenet/mobilefacenet.param") != 0 ||
-            g_mobilefacenet_net.load_model("models/mobilefacenet/mobilefacenet.bin") != 0) {
+    Precision mobilefacenet_precision = precision_from_env("SECURITY_VIEW_MOBILEFACENET_PRECISION", default_mobilefacenet_precision);
+    if (!load_net(g_mobilefacenet_net, "models/mobilefacenet/mobilefacenet", mobilefacenet_precision, 4)) {
         std::cerr << "[main] error: failed to load MobileFaceNet model." << std::endl;
         return 0;
     }
-    std::cout << "[main] info: MobileFaceNet model loaded successfully.\n";
+    std::cout << "[main] info: MobileFaceNet model loaded successfully (" << precision_name(mobilefacenet_precision) << ").\n";
+
+    g_embedding_buffer.configure(embedding_queue_capacity, embedding_queue_policy);
+    g_detection_reorder.configure(detection_params.max_in_flight);
+    g_motion_detector.configure(motion_params);
+    // ~25 s of muxed output at one chunk per frame before a stalled card
+    // holds up the muxer, which only makes the recording fall behind its ring
+    g_storage_queue.configure(512, OverflowPolicy::BLOCK);
 
     // start threads
     std::thread fps_thread = std::thread(fps_thread_func);
     std::thread db_thread = std::thread(db_thread_func);
-    std::thread recording_thread = std::thread(recording_thread_func, cv::Size(frame_width, frame_height));
-    std::thread detection_thread = std::thread(detection_thread_func);
-    std::thread embedding_thread = std::thread(embedding_thread_func);
+    load_gallery();
+    std::thread storage_thread = std::thread(storage_thread_func);
+    std::thread recording_thread = std::thread(recording_thread_func, cv::Size(frame_width, frame_height), static_cast<int>(target_fps));
+    g_scheduler.start(cpu_count);
     std::thread server_thread = std::thread(server_thread_func);
 
+    // frames are shared by detection, embedding and streaming, pre-record history
+    // lives compressed in the rings. the pool covers what can be held at once:
+    // detections running and waiting to be reordered, the embedding queue plus
+    // the batch being embedded, the frame being captured, g_frame, the two
+    // stream buffers and the recorder's decoded frames inside its encoder
+    const size_t frame_pool_size = static_cast<size_t>(detection_params.max_in_flight) * 2 + embedding_queue_capacity * 2 + 4 +
+                                   static_cast<size_t>(EncoderParams().max_pending) + 1;
+    g_frame_pool.reserve(frame_pool_size, cv::Size(frame_width, frame_height), CV_8UC3);
+    std::cout << "[main] info: preallocated " << frame_pool_size << " frame buffers.\n";
+
     std::cout << "[main] info: starting frame recording.\n";
-    cv::Mat frame, gray;
     while (!g_exit_main_thread.load()) {
         // frame start info
         const auto frame_start = std::chrono::steady_clock::now();
 
-        // capture frame
-        video_capture >> frame;
-        if (frame.empty()) {
+        // capture frame straight into a pooled buffer
+        FrameHandle frame = g_frame_pool.acquire();
+        if (!video_capture.read(frame.writable(), std::chrono::milliseconds(1000)) || frame.empty()) {
             std::cout << "[main] warning: no valid frame, sleeping 200ms and retrying" << std::endl;
             std::this_thread::sleep_for(std::chrono::milliseconds(200));
             continue;
@@ -99,18 +172,19 @@ int main() {
         g_frame_count.fetch_add(1);
         const auto frame_end = std::chrono::steady_clock::now();
 
-        // record frame
+        // record frame, every consumer shares the same buffer
         { std::lock_guard<std::mutex> lock(g_frame_mutex);
-            g_frame = frame.clone();
-        }
-        
-        { std::lock_guard<std::mutex> lock(g_recording_buffer_mutex);
-            g_recording_buffer.push({ frame.clone(), frame_end });
+            g_frame = frame;
+            ++g_frame_seq;
         }
+        schedule_detection(detection_params);
 
         { std::lock_guard<std::mutex> lock(g_streaming_buffer_mutex);
             g_streaming_buffer = std::move(frame);
+            g_streaming_buffer_time = frame_end;
         }
+        raw_broadcast_task().schedule();
+        g_recording_trigger.notify_frame();
 
         // sleep for target fps
         auto frame_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(frame_end - frame_start);
@@ -119,22 +193,23 @@ int main() {
         }
     }
 
-    video_capture.release();
+    video_capture.close();
     cv::destroyAllWindows();
 
     g_exit_server_thread.store(true);
     server_thread.join();
+
+    // capture has stopped so nothing schedules new work, the scheduler drains what is
+    // already queued before it stops
+    g_scheduler.stop();
     
-    g_exit_embedding_thread.store(true);
-    g_embedding_buffer_cv.notify_one();
-    embedding_thread.join();
-    
-    g_exit_detection_thread.store(true);
-    detection_thread.join();
-    
-    g_should_record.store(false);
-    g_exit_recording_thread.store(true);
+    g_recording_trigger.stop();
     recording_thread.join();
+
+    // the last segment is flushed and fsynced before exit
+    g_exit_storage_thread.store(true);
+    g_storage_queue.notify();
+    storage_thread.join();
     
     g_exit_db_thread.store(true);
     g_sql_queue_cv.notify_one();
@@ -0,0 +1,102 @@
+#ifndef MEDIA_PIPELINE_HPP
+#define MEDIA_PIPELINE_HPP
+
+#include <gst/gst.h>
+
+#include <iostream>
+#include <string>
+
+inline void ensure_gst_init() {
+    if (!gst_is_initialized()) gst_init(nullptr, nullptr);
+}
+
+inline bool has_gst_element(const char* name) {
+    ensure_gst_init();
+    GstElementFactory* factory = gst_element_factory_find(name);
+    if (!factory) return false;
+    gst_object_unref(factory);
+    return true;
+}
+
+// owns a gst-launch style pipeline and its bus. tag prefixes log lines
+class MediaPipeline {
+public:
+    explicit MediaPipeline(const char* tag) : tag_(tag) {}
+    MediaPipeline(const MediaPipeline&) = delete;
+    MediaPipeline& operator=(const MediaPipeline&) = delete;
+    ~MediaPipeline() { stop(); }
+
+    // builds the pipeline. call start() once probes and sinks are hooked up
+    bool launch(const std::string& description) {
+        stop();
+        ensure_gst_init();
+        GError* error = nullptr;
+        pipeline_ = gst_parse_launch(description.c_str(), &error);
+        if (error) {
+            std::cerr << "[" << tag_ << "] warning: could not build pipeline: " << error->message << "\n";
+            g_error_free(error);
+            stop();
+            return false;
+        }
+        bus_ = gst_element_get_bus(pipeline_);
+        return true;
+    }
+
+    bool start() {
+        if (!pipeline_) return false;
+        if (gst_element_set_state(pipeline_, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            std::cerr << "[" << tag_ << "] warning: pipeline failed to start.\n";
+            stop();
+            return false;
+        }
+        return true;
+    }
+
+    bool is_running() const { return pipeline_ != nullptr; }
+
+    // named element, the caller owns the returned reference
+    GstElement* element(const char* name) const {
+        return pipeline_ ? gst_bin_get_by_name(GST_BIN(pipeline_), name) : nullptr;
+    }
+
+    // errors surface on the bus after the pipeline is already playing
+    bool failed() {
+        if (!bus_) return true;
+        GstMessage* msg = gst_bus_pop_filtered(bus_, GST_MESSAGE_ERROR);
+        if (!msg) return false;
+        GError* error = nullptr;
+        gst_message_parse_error(msg, &error, nullptr);
+        std::cerr << "[" << tag_ << "] error: pipeline failed: " << (error ? error->message : "unknown") << "\n";
+        if (error) g_error_free(error);
+        gst_message_unref(msg);
+        return true;
+    }
+
+    // waits for end of stream to reach the sinks after it was sent
+    bool wait_eos(GstClockTime timeout) {
+        if (!bus_) return false;
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus_, timeout, static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (!msg) {
+            std::cerr << "[" << tag_ << "] warning: pipeline did not drain in time.\n";
+            return false;
+        }
+        const bool eos = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+        gst_message_unref(msg);
+        return eos;
+    }
+
+    void stop() {
+        if (pipeline_) gst_element_set_state(pipeline_, GST_STATE_NULL);
+        if (bus_) gst_object_unref(bus_);
+        if (pipeline_) gst_object_unref(pipeline_);
+        bus_ = nullptr;
+        pipeline_ = nullptr;
+    }
+
+private:
+    const char* tag_;
+    GstElement* pipeline_ = nullptr;
+    GstBus* bus_ = nullptr;
+};
+
+#endif
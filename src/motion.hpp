@@ -0,0 +1,106 @@
+#ifndef MOTION_HPP
+#define MOTION_HPP
+
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+struct MotionParams {
+    int width = 160;                  // frames are compared at this width, aspect kept
+    int pixel_threshold = 25;         // grey level change that counts as motion
+    float min_area_fraction = 0.002f; // changed pixels below this fraction of the frame are noise
+    double background_rate = 0.05;   // how fast the background model follows the scene
+    std::chrono::milliseconds keyframe_interval{1000}; // detect at least this often regardless of motion
+};
+
+struct MotionResult {
+    bool active = false;           // enough of the frame changed
+    bool keyframe = false;         // the keyframe interval elapsed
+    float changed_fraction = 0.f;
+    std::vector<cv::Rect> regions; // changed areas in full frame coordinates
+};
+
+// cheap change detector in front of face detection. each frame is shrunk to
+// a small greyscale image and compared against a running average background,
+// so lighting drift is absorbed while people walking in are not
+class MotionDetector {
+public:
+    explicit MotionDetector(const MotionParams& params = MotionParams()) : params_(params) {}
+    MotionDetector(const MotionDetector&) = delete;
+    MotionDetector& operator=(const MotionDetector&) = delete;
+
+    void configure(const MotionParams& params) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        params_ = params;
+        background_.release();
+    }
+
+    // compares frame against the background and folds it in. the first frame
+    // and every frame after the keyframe interval come back as keyframes
+    MotionResult update(const cv::Mat& frame) {
+        MotionResult result;
+        if (frame.empty()) return result;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto now = std::chrono::steady_clock::now();
+
+        const int width = std::min(params_.width, frame.cols);
+        const int height = std::max(1, frame.rows * width / frame.cols);
+        cv::resize(frame, small_, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+        if (small_.channels() == 3) cv::cvtColor(small_, gray_, cv::COLOR_BGR2GRAY);
+        else small_.copyTo(gray_);
+        cv::GaussianBlur(gray_, gray_, cv::Size(5, 5), 0);
+
+        if (background_.empty() || background_.size() != gray_.size()) {
+            gray_.convertTo(background_, CV_32F);
+            last_keyframe_ = now;
+            result.keyframe = true;
+            return result;
+        }
+
+        background_.convertTo(background_u8_, CV_8U);
+        cv::absdiff(gray_, background_u8_, diff_);
+        cv::threshold(diff_, mask_, params_.pixel_threshold, 255, cv::THRESH_BINARY);
+        cv::accumulateWeighted(gray_, background_, params_.background_rate);
+
+        const int changed = cv::countNonZero(mask_);
+        result.changed_fraction = static_cast<float>(changed) / static_cast<float>(mask_.total());
+        result.active = result.changed_fraction >= params_.min_area_fraction;
+
+        if (result.active) {
+            // join nearby blobs so one person is one region
+            cv::dilate(mask_, mask_, cv::Mat(), cv::Point(-1, -1), 2);
+            cv::findContours(mask_, contours_, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+            const float sx = static_cast<float>(frame.cols) / width;
+            const float sy = static_cast<float>(frame.rows) / height;
+            const double min_area = params_.min_area_fraction * mask_.total();
+            for (const std::vector<cv::Point>& contour : contours_) {
+                cv::Rect r = cv::boundingRect(contour);
+                if (r.area() < min_area) continue;
+                result.regions.emplace_back(
+                    static_cast<int>(r.x * sx), static_cast<int>(r.y * sy),
+                    static_cast<int>(r.width * sx), static_cast<int>(r.height * sy));
+            }
+        }
+
+        if (now - last_keyframe_ >= params_.keyframe_interval) {
+            last_keyframe_ = now;
+            result.keyframe = true;
+        }
+        return result;
+    }
+
+private:
+    std::mutex mutex_;
+    MotionParams params_;
+    std::chrono::steady_clock::time_point last_keyframe_;
+
+    // scratch images reused across frames
+    cv::Mat small_, gray_, background_, background_u8_, diff_, mask_;
+    std::vector<std::vector<cv::Point>> contours_;
+};
+
+#endif
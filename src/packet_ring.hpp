@@ -0,0 +1,166 @@
+#ifndef PACKET_RING_HPP
+#define PACKET_RING_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// one compressed frame: an h.264 access unit from the capture encoder, or a
+// jpeg from the raw stream
+struct EncodedPacket {
+    uint64_t seq = 0;          // assigned by the ring, increases by one per packet
+    uint64_t pts = 0;          // ns
+    bool keyframe = false;     // decodes on its own, every jpeg is one
+    std::chrono::steady_clock::time_point steady_time;
+    std::vector<uint8_t> data;
+};
+
+// pre-event buffer of compressed frames in a fixed byte budget. payloads
+// are packed back to back in one preallocated arena and described by a
+// fixed array of slots, both circular. making room only ever drops the
+// oldest packets, so a push costs one copy plus O(1) per packet evicted,
+// and memory stays at the budget however long the pre-roll is
+class PacketRing {
+public:
+    // allocates the arena and slots, dropping whatever was buffered
+    void configure(size_t budget_bytes, size_t max_packets) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        arena_.assign(std::max<size_t>(1, budget_bytes), 0);
+        slots_.assign(std::max<size_t>(1, max_packets), Slot());
+        head_ = 0;
+        count_ = 0;
+        write_ = 0;
+        bytes_ = 0;
+        first_seq_ = next_seq_;
+    }
+
+    // false if the packet alone is larger than the budget
+    bool push(const uint8_t* data, size_t size, uint64_t pts, bool keyframe, std::chrono::steady_clock::time_point steady_time) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const size_t budget = arena_.size();
+        if (size > budget) {
+            ++rejected_;
+            return false;
+        }
+
+        // a payload never wraps, if the tail is too short it starts over at 0
+        // and the tail is given up along with whatever lived there
+        const bool wrap = write_ + size > budget;
+        const size_t claim = wrap ? budget - write_ + size : size;
+        while (count_ > 0) {
+            const Slot& oldest = slots_[head_];
+            const size_t distance = (oldest.offset + budget - write_) % budget;
+            const bool full = distance == 0 && bytes_ > 0;
+            if (count_ < slots_.size() && !full && distance >= claim) break;
+            evict();
+        }
+
+        const size_t offset = wrap ? 0 : write_;
+        if (size) std::memcpy(arena_.data() + offset, data, size);
+        Slot& slot = slots_[(head_ + count_) % slots_.size()];
+        slot.offset = offset;
+        slot.size = size;
+        slot.pts = pts;
+        slot.keyframe = keyframe;
+        slot.steady_time = steady_time;
+        if (count_ == 0) first_seq_ = next_seq_;
+        ++count_;
+        ++next_seq_;
+        bytes_ += size;
+        write_ = (offset + size) % budget;
+        return true;
+    }
+
+    // seq of the latest keyframe at or before since, or the oldest keyframe
+    // held. 0 if there is none
+    uint64_t keyframe_before(std::chrono::steady_clock::time_point since) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t seq = 0;
+        for (size_t i = 0; i < count_; ++i) {
+            const Slot& slot = slots_[(head_ + i) % slots_.size()];
+            if (!slot.keyframe) continue;
+            if (seq != 0 && slot.steady_time > since) break;
+            seq = first_seq_ + i;
+        }
+        return seq;
+    }
+
+    // copies every packet from seq on into out, returns the seq to ask for
+    // next. packets evicted before they were read can't be copied, their
+    // count goes to lost so the reader can resync on a keyframe
+    uint64_t read_from(uint64_t seq, std::vector<std::shared_ptr<const EncodedPacket>>& out, uint64_t* lost = nullptr) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (lost) *lost = seq != 0 && seq < first_seq_ ? first_seq_ - seq : 0;
+        for (size_t i = seq > first_seq_ ? seq - first_seq_ : 0; i < count_; ++i) {
+            const Slot& slot = slots_[(head_ + i) % slots_.size()];
+            auto packet = std::make_shared<EncodedPacket>();
+            packet->seq = first_seq_ + i;
+            packet->pts = slot.pts;
+            packet->keyframe = slot.keyframe;
+            packet->steady_time = slot.steady_time;
+            packet->data.assign(arena_.data() + slot.offset, arena_.data() + slot.offset + slot.size);
+            out.push_back(std::move(packet));
+        }
+        return next_seq_;
+    }
+
+    size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    size_t budget() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return arena_.size();
+    }
+
+    // span between the oldest and newest packet held
+    std::chrono::steady_clock::duration span() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count_ == 0) return std::chrono::steady_clock::duration::zero();
+        return slots_[(head_ + count_ - 1) % slots_.size()].steady_time - slots_[head_].steady_time;
+    }
+
+    uint64_t rejected() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return rejected_;
+    }
+
+private:
+    struct Slot {
+        size_t offset = 0;
+        size_t size = 0;
+        uint64_t pts = 0;
+        bool keyframe = false;
+        std::chrono::steady_clock::time_point steady_time;
+    };
+
+    void evict() {
+        bytes_ -= slots_[head_].size;
+        head_ = (head_ + 1) % slots_.size();
+        --count_;
+        ++first_seq_;
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<uint8_t> arena_ = std::vector<uint8_t>(1);
+    std::vector<Slot> slots_ = std::vector<Slot>(1);
+    size_t head_ = 0;        // oldest slot
+    size_t count_ = 0;
+    size_t write_ = 0;       // arena offset the next payload goes to
+    size_t bytes_ = 0;
+    uint64_t first_seq_ = 1; // seq of the oldest slot
+    uint64_t next_seq_ = 1;
+    uint64_t rejected_ = 0;
+};
+
+#endif
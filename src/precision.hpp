@@ -0,0 +1,80 @@
+#ifndef PRECISION_HPP
+#define PRECISION_HPP
+
+#include <net.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+// numeric precision a network runs at. fp16 keeps the fp32 weights and lets
+// ncnn store and compute in half floats where the cpu supports it. int8
+// loads the <model>-int8 files written by tools/quantize_models.sh
+enum class Precision {
+    FP32,
+    FP16,
+    INT8
+};
+
+inline const char* precision_name(Precision precision) {
+    switch (precision) {
+        case Precision::FP16: return "fp16";
+        case Precision::INT8: return "int8";
+        default: return "fp32";
+    }
+}
+
+// fp32, fp16 or int8, case insensitive. false leaves precision untouched
+inline bool parse_precision(std::string value, Precision& precision) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (value == "fp32") precision = Precision::FP32;
+    else if (value == "fp16") precision = Precision::FP16;
+    else if (value == "int8") precision = Precision::INT8;
+    else return false;
+    return true;
+}
+
+// precision from an environment variable, so a deployment can be switched
+// without a rebuild
+inline Precision precision_from_env(const char* name, Precision fallback) {
+    const char* value = std::getenv(name);
+    Precision precision = fallback;
+    if (value && !parse_precision(value, precision)) {
+        std::cerr << "[model] warning: unknown " << name << " '" << value << "', using " << precision_name(fallback) << ".\n";
+    }
+    return precision;
+}
+
+inline std::string model_stem(const std::string& stem, Precision precision) {
+    return precision == Precision::INT8 ? stem + "-int8" : stem;
+}
+
+// sets the options for precision and loads <stem>.param/.bin, or the int8
+// files. vulkan is only enabled when a gpu is actually present. a missing
+// int8 model falls back to fp32, precision is updated to what was loaded
+inline bool load_net(ncnn::Net& net, const std::string& stem, Precision& precision, int num_threads) {
+    if (precision == Precision::INT8 && !std::filesystem::exists(model_stem(stem, precision) + ".param")) {
+        std::cerr << "[model] warning: " << model_stem(stem, precision) << ".param not found, run tools/quantize_models.sh. using fp32.\n";
+        precision = Precision::FP32;
+    }
+
+    net.clear();
+    net.opt.num_threads = num_threads;
+    net.opt.use_vulkan_compute = ncnn::get_gpu_count() > 0;
+    const bool half = precision != Precision::FP32;  // layers int8 leaves alone still run in fp16
+    net.opt.use_fp16_packed = half;
+    net.opt.use_fp16_storage = half;
+    net.opt.use_fp16_arithmetic = half;
+    net.opt.use_bf16_storage = false;
+    net.opt.use_int8_inference = precision == Precision::INT8;
+    net.opt.use_int8_storage = precision == Precision::INT8;
+    net.opt.use_int8_arithmetic = precision == Precision::INT8;
+
+    const std::string path = model_stem(stem, precision);
+    return net.load_param((path + ".param").c_str()) == 0 && net.load_model((path + ".bin").c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef PREPROCESS_HPP
+#define PREPROCESS_HPP
+
+#include <opencv2/opencv.hpp>
+#include <mat.h>
+
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// where the frame landed inside the network input
+struct Letterbox {
+    float scale = 1.f;
+    int pad_x = 0;
+    int pad_y = 0;
+};
+
+// size of the blob letterbox_to_blob produces for a w x h frame
+inline cv::Size letterbox_size(int w, int h, int target_size, int align) {
+    const float scale = std::min(target_size / (float)w, target_size / (float)h);
+    const int resized_w = std::max(1, static_cast<int>(w * scale));
+    const int resized_h = std::max(1, static_cast<int>(h * scale));
+    return cv::Size((resized_w + align - 1) / align * align, (resized_h + align - 1) / align * align);
+}
+
+// bilinear resize of a bgr frame so its longest side is target_size, padded
+// with zeros up to a multiple of align, written straight into blob as planar
+// rgb floats. one pass over the source rows it samples and no intermediate
+// images. blob is only reallocated when the output size changes
+inline Letterbox letterbox_to_blob(const cv::Mat& bgr, int target_size, int align, ncnn::Mat& blob) {
+    Letterbox lb;
+    const int w = bgr.cols;
+    const int h = bgr.rows;
+    lb.scale = std::min(target_size / (float)w, target_size / (float)h);
+    const int resized_w = std::max(1, static_cast<int>(w * lb.scale));
+    const int resized_h = std::max(1, static_cast<int>(h * lb.scale));
+    const cv::Size out = letterbox_size(w, h, target_size, align);
+    const int out_w = out.width;
+    const int out_h = out.height;
+    lb.pad_x = (out_w - resized_w) / 2;
+    lb.pad_y = (out_h - resized_h) / 2;
+
+    if (blob.w != out_w || blob.h != out_h || blob.c != 3 || blob.elemsize != 4) blob.create(out_w, out_h, 3);
+
+    // horizontal taps depend only on the sizes, vertical blends are done a
+    // whole source row at a time with simd
+    thread_local std::vector<int> xofs;
+    thread_local std::vector<float> xalpha;
+    thread_local std::vector<float> row;
+    xofs.resize(resized_w);
+    xalpha.resize(resized_w);
+    row.resize(static_cast<size_t>(w) * 3 + 3);
+    const float inv_scale = 1.f / lb.scale;
+    for (int dx = 0; dx < resized_w; ++dx) {
+        float sx = std::max(0.f, (dx + 0.5f) * inv_scale - 0.5f);
+        int x0 = std::min(static_cast<int>(sx), w - 1);
+        xofs[dx] = x0 * 3;
+        xalpha[dx] = x0 < w - 1 ? sx - x0 : 0.f;
+    }
+
+    float* r = blob.channel(0);
+    float* g = blob.channel(1);
+    float* b = blob.channel(2);
+    for (int y = 0; y < out_h; ++y) {
+        float* rr = r + y * out_w;
+        float* gr = g + y * out_w;
+        float* br = b + y * out_w;
+        const int dy = y - lb.pad_y;
+        if (dy < 0 || dy >= resized_h) {
+            std::fill(rr, rr + out_w, 0.f);
+            std::fill(gr, gr + out_w, 0.f);
+            std::fill(br, br + out_w, 0.f);
+            continue;
+        }
+
+        float sy = std::max(0.f, (dy + 0.5f) * inv_scale - 0.5f);
+        int y0 = std::min(static_cast<int>(sy), h - 1);
+        int y1 = std::min(y0 + 1, h - 1);
+        simd::lerp_u8(bgr.ptr<uchar>(y0), bgr.ptr<uchar>(y1), sy - y0, row.data(), static_cast<size_t>(w) * 3);
+        row[w * 3 + 0] = row[w * 3 - 3]; // lets the last column read one pixel past the edge
+        row[w * 3 + 1] = row[w * 3 - 2];
+        row[w * 3 + 2] = row[w * 3 - 1];
+
+        std::fill(rr, rr + lb.pad_x, 0.f);
+        std::fill(gr, gr + lb.pad_x, 0.f);
+        std::fill(br, br + lb.pad_x, 0.f);
+        for (int dx = 0; dx < resized_w; ++dx) {
+            const float* p = row.data() + xofs[dx];
+            const float a = xalpha[dx];
+            br[lb.pad_x + dx] = p[0] + (p[3] - p[0]) * a;
+            gr[lb.pad_x + dx] = p[1] + (p[4] - p[1]) * a;
+            rr[lb.pad_x + dx] = p[2] + (p[5] - p[2]) * a;
+        }
+        const int right = lb.pad_x + resized_w;
+        std::fill(rr + right, rr + out_w, 0.f);
+        std::fill(gr + right, gr + out_w, 0.f);
+        std::fill(br + right, br + out_w, 0.f);
+    }
+    return lb;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef RECORDING_TRIGGER_HPP
+#define RECORDING_TRIGGER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+struct RecordingParams {
+    std::chrono::milliseconds activate_time{1000};   // someone has to stay in view this long to start
+    std::chrono::milliseconds deactivate_time{2000}; // recording runs on this long after they leave
+    std::chrono::milliseconds preroll{2000};         // history kept from before the first sighting
+    uint64_t segment_bytes = 256ull << 20;           // long recordings are cut into files of at most about this size
+    std::chrono::milliseconds segment_duration{5 * 60 * 1000}; // or this length, whichever comes first
+};
+
+enum class RecordingState {
+    IDLE,      // nobody in view
+    ARMING,    // someone in view, waiting out activate_time
+    RECORDING, // someone in view, writing
+    COOLDOWN   // nobody in view, writing until deactivate_time runs out
+};
+
+inline const char* recording_state_name(RecordingState state) {
+    switch (state) {
+    case RecordingState::IDLE: return "idle";
+    case RecordingState::ARMING: return "arming";
+    case RecordingState::RECORDING: return "recording";
+    case RecordingState::COOLDOWN: return "cooldown";
+    }
+    return "unknown";
+}
+
+// what the recorder has to do after wait() returns
+struct RecordingStep {
+    bool start = false;   // open a recording, history from since on
+    bool drain = false;   // new frames arrived, write them
+    bool end = false;     // close the recording
+    bool stopped = false; // stop() was called, exit
+    std::chrono::steady_clock::time_point since;
+};
+
+// idle -> arming -> recording -> cooldown state machine. capture reports
+// frame arrivals, the embedding stage reports whether anyone is in view, and
+// the recorder sleeps in wait() until one of those or a timer moves it on.
+// frames only wake the recorder while it is writing
+class RecordingTrigger {
+public:
+    void configure(const RecordingParams& params) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        params_ = params;
+    }
+
+    RecordingParams params() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return params_;
+    }
+
+    // called by main once per published frame
+    void notify_frame() {
+        { std::lock_guard<std::mutex> lock(mutex_);
+            ++pending_frames_;
+            if (state_ != RecordingState::RECORDING && state_ != RecordingState::COOLDOWN) return;
+        }
+        cv_.notify_one();
+    }
+
+    // called by the embedding stage with whether anyone is in the newest frame
+    void notify_detection(bool present) {
+        { std::lock_guard<std::mutex> lock(mutex_);
+            if (present) last_seen_ = std::chrono::steady_clock::now();
+            if (present == present_) return;
+            present_ = present;
+        }
+        cv_.notify_one();
+    }
+
+    void stop() {
+        { std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        cv_.notify_one();
+    }
+
+    // blocks until the recorder has something to do. a recording that is
+    // open when stop() is called gets its end step before the stopped one
+    RecordingStep wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        RecordingStep step;
+        while (true) {
+            const bool writing = state_ == RecordingState::RECORDING || state_ == RecordingState::COOLDOWN;
+            if (stopped_) {
+                step.end = writing;
+                step.stopped = !writing;
+                state_ = RecordingState::IDLE;
+                return step;
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+            switch (state_) {
+            case RecordingState::IDLE:
+                if (present_) {
+                    state_ = RecordingState::ARMING;
+                    first_seen_ = last_seen_;
+                    continue;
+                }
+                cv_.wait(lock);
+                continue;
+
+            case RecordingState::ARMING:
+                if (!present_) {
+                    state_ = RecordingState::IDLE;
+                    continue;
+                }
+                if (now - first_seen_ >= params_.activate_time) {
+                    state_ = RecordingState::RECORDING;
+                    pending_frames_ = 0;
+                    ++recordings_;
+                    step.start = true;
+                    step.since = first_seen_ - params_.preroll;
+                    return step;
+                }
+                cv_.wait_until(lock, first_seen_ + params_.activate_time);
+                continue;
+
+            case RecordingState::RECORDING:
+                if (!present_) {
+                    state_ = RecordingState::COOLDOWN;
+                    continue;
+                }
+                break;
+
+            case RecordingState::COOLDOWN:
+                if (present_) {
+                    state_ = RecordingState::RECORDING;
+                    continue;
+                }
+                if (now - last_seen_ >= params_.deactivate_time) {
+                    state_ = RecordingState::IDLE;
+                    step.end = true;
+                    return step;
+                }
+                break;
+            }
+
+            // writing, hand over whatever arrived or sleep until something does
+            if (pending_frames_ > 0) {
+                pending_frames_ = 0;
+                step.drain = true;
+                return step;
+            }
+            if (state_ == RecordingState::COOLDOWN) cv_.wait_until(lock, last_seen_ + params_.deactivate_time);
+            else cv_.wait(lock);
+        }
+    }
+
+    RecordingState state() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return state_;
+    }
+
+    uint64_t recordings() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return recordings_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    RecordingParams params_;
+    RecordingState state_ = RecordingState::IDLE;
+    bool present_ = false;
+    bool stopped_ = false;
+    uint64_t pending_frames_ = 0;
+    uint64_t recordings_ = 0;
+    std::chrono::steady_clock::time_point first_seen_;
+    std::chrono::steady_clock::time_point last_seen_;
+};
+
+#endif
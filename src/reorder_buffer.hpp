@@ -0,0 +1,51 @@
+#ifndef REORDER_BUFFER_HPP
+#define REORDER_BUFFER_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// restores ticket order for results produced by parallel workers. tickets are
+// handed out consecutively and at most capacity of them are in flight, so a
+// ring of capacity slots is enough to park results that finish early
+template <typename T>
+class ReorderBuffer {
+public:
+    ReorderBuffer(size_t capacity = 1) {
+        configure(capacity);
+    }
+    ReorderBuffer(const ReorderBuffer&) = delete;
+    ReorderBuffer& operator=(const ReorderBuffer&) = delete;
+
+    // call before any tickets are issued
+    void configure(size_t capacity) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.clear();
+        slots_.resize(capacity > 0 ? capacity : 1);
+        next_ticket_ = 0;
+    }
+
+    // parks the result for ticket and emits every result that is now in order.
+    // emit runs under the buffer lock so emitted results keep their order
+    template <typename Emit>
+    void push(uint64_t ticket, T result, Emit emit) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_[ticket % slots_.size()] = std::move(result);
+        while (true) {
+            std::optional<T>& slot = slots_[next_ticket_ % slots_.size()];
+            if (!slot) break;
+            T ready = std::move(*slot);
+            slot.reset();
+            ++next_ticket_;
+            emit(std::move(ready));
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::optional<T>> slots_;
+    uint64_t next_ticket_ = 0;
+};
+
+#endif
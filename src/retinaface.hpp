@@ -0,0 +1,140 @@
+#ifndef RETINAFACE_HPP
+#define RETINAFACE_HPP
+
+#include <net.h>
+#include <mat.h>
+
+#include "types.hpp"
+#include "inference.hpp"
+#include "retinaface_postprocess.hpp"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// output heads and decoding settings of the mnet.25 retinaface model
+struct RetinaFaceConfig {
+    struct Stride {
+        int feat_stride;
+        std::vector<float> scales;  // anchor sizes in multiples of base_size
+        std::string score_blob;
+        std::string bbox_blob;
+        std::string landmark_blob;
+    };
+
+    std::string input_blob = "data";
+    int target_size = 640;          // longest side of a letterboxed frame
+    int align = 32;                 // input padding, the coarsest stride
+    int base_size = 16;
+    std::vector<Stride> strides = {
+        { 32, { 32.f, 16.f }, "face_rpn_cls_prob_reshape_stride32", "face_rpn_bbox_pred_stride32", "face_rpn_landmark_pred_stride32" },
+        { 16, { 8.f, 4.f }, "face_rpn_cls_prob_reshape_stride16", "face_rpn_bbox_pred_stride16", "face_rpn_landmark_pred_stride16" },
+        { 8, { 2.f, 1.f }, "face_rpn_cls_prob_reshape_stride8", "face_rpn_bbox_pred_stride8", "face_rpn_landmark_pred_stride8" },
+    };
+    float prob_threshold = 0.8f;
+    float nms_threshold = 0.4f;
+    size_t pre_nms_top_k = 500;
+    size_t max_faces = 64;
+    size_t max_cached_sizes = 64;   // anchor grids kept for odd sized inputs such as edge tiles
+};
+
+// retinaface decoding with anchor grids built once per feature map size.
+// prepare() fills them in for the input sizes known at model load, any
+// other size gets its grids built on first use and cached. shared by every
+// detection task, the per run state lives in the InferenceContext
+class RetinaFaceDetector {
+public:
+    explicit RetinaFaceDetector(const RetinaFaceConfig& config = RetinaFaceConfig()) : config_(config) {}
+
+    const RetinaFaceConfig& config() const { return config_; }
+
+    // builds the grids for a w x h network input. assumes the model pads
+    // like mnet.25, so a stride s head is ceil(w / s) x ceil(h / s)
+    void prepare(int w, int h) {
+        for (size_t s = 0; s < config_.strides.size(); ++s) {
+            const int feat_stride = config_.strides[s].feat_stride;
+            grid(s, (w + feat_stride - 1) / feat_stride, (h + feat_stride - 1) / feat_stride);
+        }
+    }
+
+    size_t cached_grids() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return grids_.size();
+    }
+
+    // runs the network on a planar rgb float blob, boxes are in blob pixels
+    std::vector<FaceObject> detect(const ncnn::Mat& in, InferenceContext& context) const {
+        ncnn::Extractor& ex = context.begin();
+        ex.input(config_.input_blob.c_str(), in);
+
+        thread_local std::vector<retinaface::Proposal> proposals;
+        thread_local std::vector<int> picked;
+        proposals.clear();
+
+        for (size_t s = 0; s < config_.strides.size(); ++s) {
+            const RetinaFaceConfig::Stride& stride = config_.strides[s];
+            ncnn::Mat score_blob, bbox_blob, landmark_blob;
+            ex.extract(stride.score_blob.c_str(), score_blob);
+            ex.extract(stride.bbox_blob.c_str(), bbox_blob);
+            ex.extract(stride.landmark_blob.c_str(), landmark_blob);
+
+            const std::shared_ptr<const retinaface::AnchorGrid> anchors = grid(s, score_blob.w, score_blob.h);
+            retinaface::generate_proposals(*anchors, score_blob, bbox_blob, landmark_blob, config_.prob_threshold, proposals);
+        }
+
+        // best proposals first, then greedy nms
+        retinaface::sort_top_k(proposals, config_.pre_nms_top_k);
+        retinaface::nms(proposals, config_.nms_threshold, config_.max_faces, picked);
+
+        const float img_w = static_cast<float>(in.w);
+        const float img_h = static_cast<float>(in.h);
+        std::vector<FaceObject> faceobjects(picked.size());
+        for (size_t i = 0; i < picked.size(); ++i) {
+            const retinaface::Proposal& p = proposals[picked[i]];
+
+            // clip to image size
+            const float x0 = std::max(std::min(p.x0, img_w - 1), 0.f);
+            const float y0 = std::max(std::min(p.y0, img_h - 1), 0.f);
+            const float x1 = std::max(std::min(p.x1 + 1, img_w - 1), 0.f);
+            const float y1 = std::max(std::min(p.y1 + 1, img_h - 1), 0.f);
+
+            FaceObject& fo = faceobjects[i];
+            fo.prob = p.prob;
+            fo.rect.x = x0;
+            fo.rect.y = y0;
+            fo.rect.width = x1 - x0;
+            fo.rect.height = y1 - y0;
+            for (int k = 0; k < 5; ++k) {
+                fo.landmarks[k].x = p.landmarks[2 * k + 0];
+                fo.landmarks[k].y = p.landmarks[2 * k + 1];
+            }
+        }
+        return faceobjects;
+    }
+
+private:
+    // grids are immutable once built. past max_cached_sizes a grid is built
+    // for the caller alone and freed with its shared_ptr
+    std::shared_ptr<const retinaface::AnchorGrid> grid(size_t stride_index, int w, int h) const {
+        const auto key = std::make_tuple(stride_index, w, h);
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = grids_.find(key);
+        if (it != grids_.end()) return it->second;
+
+        const RetinaFaceConfig::Stride& stride = config_.strides[stride_index];
+        auto built = std::make_shared<const retinaface::AnchorGrid>(
+            retinaface::make_anchor_grid(config_.base_size, stride.scales, stride.feat_stride, w, h));
+        if (grids_.size() < config_.max_cached_sizes * config_.strides.size()) grids_.emplace(key, built);
+        return built;
+    }
+
+    RetinaFaceConfig config_;
+    mutable std::mutex mutex_;
+    mutable std::map<std::tuple<size_t, int, int>, std::shared_ptr<const retinaface::AnchorGrid>> grids_;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef RETINAFACE_POSTPROCESS_HPP
+#define RETINAFACE_POSTPROCESS_HPP
+
+#include <mat.h>
+
+#include "types.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// retinaface output decoding. cells are thresholded before anything else
+// is touched, so the per frame cost follows the handful of likely faces
+// instead of the whole score map
+namespace retinaface {
+
+struct Proposal {
+    float prob;
+    float x0, y0, x1, y1;    // box corners, inclusive like the reference decoder
+    float landmarks[10];     // x, y for each of the 5 points
+};
+
+inline float area(float x0, float y0, float x1, float y1) {
+    return std::max(0.f, x1 - x0 + 1) * std::max(0.f, y1 - y0 + 1);
+}
+
+inline float iou(const Proposal& a, const Proposal& b, float area_a, float area_b) {
+    const float ix0 = std::max(a.x0, b.x0);
+    const float iy0 = std::max(a.y0, b.y0);
+    const float ix1 = std::min(a.x1, b.x1);
+    const float iy1 = std::min(a.y1, b.y1);
+    if (ix1 < ix0 || iy1 < iy0) return 0.f;
+    const float inter = area(ix0, iy0, ix1, iy1);
+    return inter / (area_a + area_b - inter);
+}
+
+// anchor boxes of one output stride laid over a w x h feature map. every
+// anchor/cell pair has its centre precomputed, so decoding is a lookup
+struct AnchorGrid {
+    int feat_stride = 0;
+    int w = 0;
+    int h = 0;
+    std::vector<float> anchor_w;  // per anchor
+    std::vector<float> anchor_h;
+    std::vector<float> cx;        // per anchor, then per cell, row-major
+    std::vector<float> cy;
+
+    int num_anchors() const { return static_cast<int>(anchor_w.size()); }
+};
+
+// square anchors of base_size * scale centred on each cell, matching the
+// reference generate_anchors with a single 1:1 ratio
+inline AnchorGrid make_anchor_grid(int base_size, const std::vector<float>& scales, int feat_stride, int w, int h) {
+    AnchorGrid grid;
+    grid.feat_stride = feat_stride;
+    grid.w = w;
+    grid.h = h;
+    const size_t cells = static_cast<size_t>(w) * h;
+    grid.cx.resize(scales.size() * cells);
+    grid.cy.resize(scales.size() * cells);
+    for (size_t q = 0; q < scales.size(); ++q) {
+        const float size = base_size * scales[q];
+        const float x0 = -size * 0.5f;
+        const float y0 = -size * 0.5f;
+        grid.anchor_w.push_back(size);
+        grid.anchor_h.push_back(size);
+        for (int i = 0; i < h; ++i) {
+            for (int j = 0; j < w; ++j) {
+                grid.cx[q * cells + i * w + j] = x0 + j * feat_stride + size * 0.5f;
+                grid.cy[q * cells + i * w + j] = y0 + i * feat_stride + size * 0.5f;
+            }
+        }
+    }
+    return grid;
+}
+
+// appends a proposal for every cell of every anchor scoring at least
+// prob_threshold. grid must match the blobs' feature map size
+inline void generate_proposals(const AnchorGrid& grid, const ncnn::Mat& score_blob, const ncnn::Mat& bbox_blob,
+                               const ncnn::Mat& landmark_blob, float prob_threshold, std::vector<Proposal>& out) {
+    thread_local std::vector<int> cells;
+    const size_t cell_count = static_cast<size_t>(grid.w) * grid.h;
+    const int num_anchors = grid.num_anchors();
+
+    for (int q = 0; q < num_anchors; ++q) {
+        // the first num_anchors channels are the background scores
+        const float* score = score_blob.channel(q + num_anchors);
+        cells.clear();
+        simd::find_ge(score, cell_count, prob_threshold, cells);
+        if (cells.empty()) continue;
+
+        const float anchor_w = grid.anchor_w[q];
+        const float anchor_h = grid.anchor_h[q];
+        const float* centre_x = grid.cx.data() + q * cell_count;
+        const float* centre_y = grid.cy.data() + q * cell_count;
+
+        const float* box[4];
+        for (int k = 0; k < 4; ++k) box[k] = bbox_blob.channel(q * 4 + k);
+        const float* landmark[10];
+        for (int k = 0; k < 10; ++k) landmark[k] = landmark_blob.channel(q * 10 + k);
+
+        for (int index : cells) {
+            const float cx = centre_x[index];
+            const float cy = centre_y[index];
+
+            const float pb_cx = cx + anchor_w * box[0][index];
+            const float pb_cy = cy + anchor_h * box[1][index];
+            const float pb_w = anchor_w * std::exp(box[2][index]);
+            const float pb_h = anchor_h * std::exp(box[3][index]);
+
+            Proposal p;
+            p.prob = score[index];
+            p.x0 = pb_cx - pb_w * 0.5f;
+            p.y0 = pb_cy - pb_h * 0.5f;
+            p.x1 = pb_cx + pb_w * 0.5f;
+            p.y1 = pb_cy + pb_h * 0.5f;
+            for (int k = 0; k < 5; ++k) {
+                p.landmarks[2 * k + 0] = cx + (anchor_w + 1) * landmark[2 * k + 0][index];
+                p.landmarks[2 * k + 1] = cy + (anchor_h + 1) * landmark[2 * k + 1][index];
+            }
+            out.push_back(p);
+        }
+    }
+}
+
+// keeps the k most likely proposals, best first
+inline void sort_top_k(std::vector<Proposal>& proposals, size_t k) {
+    auto better = [](const Proposal& a, const Proposal& b) { return a.prob > b.prob; };
+    if (proposals.size() > k) {
+        std::partial_sort(proposals.begin(), proposals.begin() + k, proposals.end(), better);
+        proposals.resize(k);
+    } else {
+        std::sort(proposals.begin(), proposals.end(), better);
+    }
+}
+
+// greedy nms over proposals sorted best first. suppressed boxes are marked
+// in a mask so they are never compared again, and the scan stops once
+// max_keep boxes are kept
+inline void nms(const std::vector<Proposal>& sorted, float threshold, size_t max_keep, std::vector<int>& picked) {
+    thread_local std::vector<float> areas;
+    thread_local std::vector<uint8_t> suppressed;
+    picked.clear();
+    const size_t n = sorted.size();
+    areas.resize(n);
+    suppressed.assign(n, 0);
+    for (size_t i = 0; i < n; ++i) areas[i] = area(sorted[i].x0, sorted[i].y0, sorted[i].x1, sorted[i].y1);
+
+    for (size_t i = 0; i < n && picked.size() < max_keep; ++i) {
+        if (suppressed[i]) continue;
+        picked.push_back(static_cast<int>(i));
+        for (size_t j = i + 1; j < n; ++j) {
+            if (!suppressed[j] && iou(sorted[i], sorted[j], areas[i], areas[j]) > threshold) suppressed[j] = 1;
+        }
+    }
+}
+
+// sorts faces by prob and drops the weaker of any overlapping pair, for
+// merging detections from several passes over one frame
+inline void merge_faces(std::vector<FaceObject>& faces, float threshold) {
+    thread_local std::vector<Proposal> boxes;
+    thread_local std::vector<int> picked;
+    thread_local std::vector<FaceObject> merged;
+    std::sort(faces.begin(), faces.end(), [](const FaceObject& a, const FaceObject& b) { return a.prob > b.prob; });
+    boxes.resize(faces.size());
+    for (size_t i = 0; i < faces.size(); ++i) {
+        const cv::Rect& r = faces[i].rect;
+        boxes[i].prob = faces[i].prob;
+        boxes[i].x0 = r.x;
+        boxes[i].y0 = r.y;
+        boxes[i].x1 = r.x + r.width - 1;
+        boxes[i].y1 = r.y + r.height - 1;
+    }
+    nms(boxes, threshold, boxes.size(), picked);
+    merged.clear();
+    for (int i : picked) merged.push_back(std::move(faces[i]));
+    faces.swap(merged);
+}
+
+}
+
+#endif
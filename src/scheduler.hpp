@@ -0,0 +1,169 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// shared task pool with one deque per worker. a worker runs its own newest
+// task first (the data is still in cache) and steals the oldest task from
+// another worker when it runs dry, so whichever pipeline stage is backed up
+// gets every idle core
+class Scheduler {
+public:
+    using Task = std::function<void()>;
+
+    Scheduler() = default;
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+    ~Scheduler() { stop(); }
+
+    // start before the first submit and stop once nothing submits from outside
+    void start(size_t worker_count) {
+        if (!workers_.empty()) return;
+        stopping_.store(false);
+        worker_count = worker_count > 0 ? worker_count : 1;
+        for (size_t i = 0; i < worker_count; ++i) queues_.push_back(std::make_unique<WorkQueue>());
+        for (size_t i = 0; i < worker_count; ++i) workers_.emplace_back(&Scheduler::worker_loop, this, i);
+        std::cout << "[scheduler] info: started " << worker_count << " workers.\n";
+    }
+
+    // workers drain their queues before exiting, so every queued task runs
+    // before stop() returns
+    void stop() {
+        if (workers_.empty()) return;
+        { std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stopping_.store(true);
+        }
+        sleep_cv_.notify_all();
+        for (std::thread& worker : workers_) worker.join();
+        workers_.clear();
+        queues_.clear();
+        queued_.store(0);
+    }
+
+    // from a worker the task goes on that worker's own deque, otherwise the
+    // deques are filled round robin
+    void submit(Task task) {
+        if (workers_.empty()) return;
+        size_t index = (current_ == this) ? current_index_ : next_queue_.fetch_add(1) % queues_.size();
+        // counted under the deque lock, before a worker can pop and subtract it
+        { std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+            queued_.fetch_add(1);
+            queues_[index]->tasks.push_back(std::move(task));
+        }
+        { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+        sleep_cv_.notify_one();
+    }
+
+    size_t worker_count() const { return workers_.size(); }
+    size_t queued() const { return queued_.load(); }
+    uint64_t steals() const { return steals_.load(); }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool pop_local(size_t index, Task& out) {
+        WorkQueue& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        out = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, Task& out) {
+        for (size_t i = 1; i < queues_.size(); ++i) {
+            WorkQueue& queue = *queues_[(thief + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            out = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            steals_.fetch_add(1);
+            return true;
+        }
+        return false;
+    }
+
+    void worker_loop(size_t index) {
+        current_ = this;
+        current_index_ = index;
+
+        while (true) {
+            Task task;
+            if (pop_local(index, task) || steal(index, task)) {
+                queued_.fetch_sub(1);
+                try {
+                    task();
+                } catch (const std::exception& e) {
+                    std::cerr << "[scheduler] error: task threw: " << e.what() << "\n";
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleep_cv_.wait(lock, [this] { return queued_.load() > 0 || stopping_.load(); });
+            if (stopping_.load()) break;
+        }
+
+        current_ = nullptr;
+    }
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> next_queue_{0};
+    std::atomic<uint64_t> steals_{0};
+    std::atomic<bool> stopping_{false};
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+
+    static thread_local Scheduler* current_;
+    static thread_local size_t current_index_;
+};
+
+inline thread_local Scheduler* Scheduler::current_ = nullptr;
+inline thread_local size_t Scheduler::current_index_ = 0;
+
+// a task that never runs concurrently with itself, for stages that keep
+// state or must emit in order. schedule() while it is queued or running
+// makes it run once more afterwards, so no request is lost
+class SerialTask {
+public:
+    SerialTask(Scheduler& scheduler, std::function<void()> fn) : scheduler_(scheduler), fn_(std::move(fn)) {}
+    SerialTask(const SerialTask&) = delete;
+    SerialTask& operator=(const SerialTask&) = delete;
+
+    void schedule() {
+        if (requests_.fetch_add(1) == 0) scheduler_.submit([this] { run(); });
+    }
+
+private:
+    void run() {
+        const uint32_t handled = requests_.load();
+        try {
+            fn_();
+        } catch (const std::exception& e) {
+            std::cerr << "[scheduler] error: serial task threw: " << e.what() << "\n";
+        }
+        // requests that arrived while fn_ ran get one more pass
+        if (requests_.fetch_sub(handled) != handled) scheduler_.submit([this] { run(); });
+    }
+
+    Scheduler& scheduler_;
+    std::function<void()> fn_;
+    std::atomic<uint32_t> requests_{0};
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef SEGMENT_FILE_HPP
+#define SEGMENT_FILE_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// a unit of work for the storage thread. a segment is one open, any number
+// of writes and one close, in queue order
+struct StorageChunk {
+    enum class Op { OPEN, WRITE, CLOSE };
+    Op op = Op::WRITE;
+    std::string path;          // OPEN only
+    std::vector<uint8_t> data; // WRITE only
+};
+
+// one recording segment on disk. appends are gathered into an aligned block
+// and written a block at a time, with O_DIRECT where the filesystem takes
+// it so a long recording doesn't churn the page cache on a small board.
+// the unaligned tail goes out buffered, then the file is fsynced on close.
+// not thread safe, owned by the storage thread
+class SegmentFile {
+public:
+    explicit SegmentFile(size_t block_bytes = 1 << 20) {
+        // O_DIRECT wants buffer, offset and length aligned to the logical block
+        block_bytes_ = std::max<size_t>(alignment, block_bytes / alignment * alignment);
+        void* block = nullptr;
+        if (posix_memalign(&block, alignment, block_bytes_) != 0) block = nullptr;
+        block_ = static_cast<uint8_t*>(block);
+    }
+    SegmentFile(const SegmentFile&) = delete;
+    SegmentFile& operator=(const SegmentFile&) = delete;
+    ~SegmentFile() {
+        close();
+        std::free(block_);
+    }
+
+    bool open(const std::string& path) {
+        close();
+        if (!block_) return false;
+        direct_ = false;
+#ifdef O_DIRECT
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        direct_ = fd_ >= 0;
+#endif
+        // tmpfs and some fuse mounts refuse O_DIRECT
+        if (fd_ < 0) fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            std::cerr << "[storage] error: could not open " << path << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+        path_ = path;
+        fill_ = 0;
+        bytes_ = 0;
+        failed_ = false;
+        max_write_ms_ = 0;
+        return true;
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    // false once a write has failed, the rest of the segment is dropped
+    bool append(const uint8_t* data, size_t size) {
+        if (fd_ < 0 || failed_) return false;
+        while (size > 0) {
+            const size_t n = std::min(size, block_bytes_ - fill_);
+            std::memcpy(block_ + fill_, data, n);
+            fill_ += n;
+            data += n;
+            size -= n;
+            if (fill_ == block_bytes_ && !flush_block()) return false;
+        }
+        return true;
+    }
+
+    // writes the tail, fsyncs and closes. false if anything was lost
+    bool close() {
+        if (fd_ < 0) return true;
+        if (fill_ > 0 && !failed_) {
+            // the tail isn't block sized, drop O_DIRECT for the last write
+#ifdef O_DIRECT
+            if (direct_) fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+#endif
+            flush_block();
+        }
+        if (!failed_ && fsync(fd_) != 0) fail("fsync");
+        ::close(fd_);
+        fd_ = -1;
+        return !failed_;
+    }
+
+    bool direct() const { return direct_; }
+    uint64_t bytes() const { return bytes_; }
+    double max_write_ms() const { return max_write_ms_; } // slowest block write this segment
+
+    static constexpr size_t alignment = 4096;
+
+private:
+    bool flush_block() {
+        const auto start = std::chrono::steady_clock::now();
+        size_t done = 0;
+        while (done < fill_) {
+            const ssize_t n = ::write(fd_, block_ + done, fill_ - done);
+            if (n < 0 && errno == EINTR) continue;
+#ifdef O_DIRECT
+            // some filesystems take the O_DIRECT open but not the write
+            if (n < 0 && errno == EINVAL && direct_) {
+                fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+                direct_ = false;
+                continue;
+            }
+#endif
+            if (n <= 0) {
+                fail("write");
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        max_write_ms_ = std::max(max_write_ms_, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        bytes_ += fill_;
+        fill_ = 0;
+        return true;
+    }
+
+    void fail(const char* what) {
+        std::cerr << "[storage] error: " << what << " failed on " << path_ << ": " << std::strerror(errno) << "\n";
+        failed_ = true;
+    }
+
+    uint8_t* block_ = nullptr;
+    size_t block_bytes_ = 0;
+    size_t fill_ = 0;
+    int fd_ = -1;
+    bool direct_ = false;
+    bool failed_ = false;
+    std::string path_;
+    uint64_t bytes_ = 0;
+    double max_write_ms_ = 0;
+};
+
+#endif
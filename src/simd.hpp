@@ -0,0 +1,280 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// allocator for row storage that starts every buffer on a cache line
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+namespace simd {
+
+#if defined(__AVX__)
+inline float hsum(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+inline __m256 madd(__m256 a, __m256 b, __m256 acc) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, acc);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), acc);
+#endif
+}
+#elif defined(__SSE__)
+inline float hsum(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+#endif
+
+inline float dot(const float* a, const float* b, size_t n) {
+    size_t i = 0;
+    float s = 0.f;
+#if defined(__AVX__)
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        acc0 = madd(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = madd(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = madd(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    s = hsum(_mm256_add_ps(acc0, acc1));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t acc0 = vdupq_n_f32(0.f);
+    float32x4_t acc1 = vdupq_n_f32(0.f);
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    s = vaddvq_f32(vaddq_f32(acc0, acc1));
+#elif defined(__SSE__)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)), acc);
+    }
+    s = hsum(acc);
+#endif
+    for (; i < n; ++i) {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+
+// scores[r] = dot(matrix row r, probe) over a row-major matrix with row stride
+inline void gemv(const float* matrix, size_t rows, size_t stride, const float* probe, size_t n, float* scores) {
+    for (size_t r = 0; r < rows; ++r) {
+        scores[r] = dot(matrix + r * stride, probe, n);
+    }
+}
+
+// scores[p * rows + r] = dot(matrix row r, probe p). four probes share each
+// pass over a matrix row so the gallery is streamed from memory once per block
+inline void gemm(const float* matrix, size_t rows, size_t stride, const float* probes, size_t probe_count, size_t probe_stride, size_t n, float* scores) {
+    size_t p = 0;
+    for (; p + 4 <= probe_count; p += 4) {
+        const float* p0 = probes + (p + 0) * probe_stride;
+        const float* p1 = probes + (p + 1) * probe_stride;
+        const float* p2 = probes + (p + 2) * probe_stride;
+        const float* p3 = probes + (p + 3) * probe_stride;
+        for (size_t r = 0; r < rows; ++r) {
+            const float* row = matrix + r * stride;
+            size_t i = 0;
+            float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+#if defined(__AVX__)
+            __m256 acc0 = _mm256_setzero_ps();
+            __m256 acc1 = _mm256_setzero_ps();
+            __m256 acc2 = _mm256_setzero_ps();
+            __m256 acc3 = _mm256_setzero_ps();
+            for (; i + 8 <= n; i += 8) {
+                __m256 v = _mm256_loadu_ps(row + i);
+                acc0 = madd(_mm256_loadu_ps(p0 + i), v, acc0);
+                acc1 = madd(_mm256_loadu_ps(p1 + i), v, acc1);
+                acc2 = madd(_mm256_loadu_ps(p2 + i), v, acc2);
+                acc3 = madd(_mm256_loadu_ps(p3 + i), v, acc3);
+            }
+            s0 = hsum(acc0); s1 = hsum(acc1); s2 = hsum(acc2); s3 = hsum(acc3);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+            float32x4_t acc0 = vdupq_n_f32(0.f);
+            float32x4_t acc1 = vdupq_n_f32(0.f);
+            float32x4_t acc2 = vdupq_n_f32(0.f);
+            float32x4_t acc3 = vdupq_n_f32(0.f);
+            for (; i + 4 <= n; i += 4) {
+                float32x4_t v = vld1q_f32(row + i);
+                acc0 = vmlaq_f32(acc0, vld1q_f32(p0 + i), v);
+                acc1 = vmlaq_f32(acc1, vld1q_f32(p1 + i), v);
+                acc2 = vmlaq_f32(acc2, vld1q_f32(p2 + i), v);
+                acc3 = vmlaq_f32(acc3, vld1q_f32(p3 + i), v);
+            }
+            s0 = vaddvq_f32(acc0); s1 = vaddvq_f32(acc1); s2 = vaddvq_f32(acc2); s3 = vaddvq_f32(acc3);
+#elif defined(__SSE__)
+            __m128 acc0 = _mm_setzero_ps();
+            __m128 acc1 = _mm_setzero_ps();
+            __m128 acc2 = _mm_setzero_ps();
+            __m128 acc3 = _mm_setzero_ps();
+            for (; i + 4 <= n; i += 4) {
+                __m128 v = _mm_loadu_ps(row + i);
+                acc0 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p0 + i), v), acc0);
+                acc1 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p1 + i), v), acc1);
+                acc2 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p2 + i), v), acc2);
+                acc3 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p3 + i), v), acc3);
+            }
+            s0 = hsum(acc0); s1 = hsum(acc1); s2 = hsum(acc2); s3 = hsum(acc3);
+#endif
+            for (; i < n; ++i) {
+                s0 += p0[i] * row[i];
+                s1 += p1[i] * row[i];
+                s2 += p2[i] * row[i];
+                s3 += p3[i] * row[i];
+            }
+            scores[(p + 0) * rows + r] = s0;
+            scores[(p + 1) * rows + r] = s1;
+            scores[(p + 2) * rows + r] = s2;
+            scores[(p + 3) * rows + r] = s3;
+        }
+    }
+    for (; p < probe_count; ++p) {
+        gemv(matrix, rows, stride, probes + p * probe_stride, n, scores + p * rows);
+    }
+}
+
+inline int32_t dot_i8(const int8_t* a, const int8_t* b, size_t n) {
+    size_t i = 0;
+    int32_t s = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    s = _mm_cvtsi128_si32(sum);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    int32x4_t acc = vdupq_n_s32(0);
+    for (; i + 16 <= n; i += 16) {
+        int8x16_t va = vld1q_s8(a + i);
+        int8x16_t vb = vld1q_s8(b + i);
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_high_s8(va, vb));
+    }
+    s = vaddvq_s32(acc);
+#endif
+    for (; i < n; ++i) {
+        s += static_cast<int32_t>(a[i]) * static_cast<int32_t>(b[i]);
+    }
+    return s;
+}
+
+// out[i] = a[i] + (b[i] - a[i]) * t over two byte rows, the vertical half of
+// a bilinear resize
+inline void lerp_u8(const uint8_t* a, const uint8_t* b, float t, float* out, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 vt = _mm256_set1_ps(t);
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + i))));
+        __m256 vb = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i))));
+        _mm256_storeu_ps(out + i, madd(_mm256_sub_ps(vb, va), vt, va));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t vt = vdupq_n_f32(t);
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t wa = vmovl_u8(vld1_u8(a + i));
+        uint16x8_t wb = vmovl_u8(vld1_u8(b + i));
+        float32x4_t a0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(wa)));
+        float32x4_t a1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(wa)));
+        float32x4_t b0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(wb)));
+        float32x4_t b1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(wb)));
+        vst1q_f32(out + i, vmlaq_f32(a0, vsubq_f32(b0, a0), vt));
+        vst1q_f32(out + i + 4, vmlaq_f32(a1, vsubq_f32(b1, a1), vt));
+    }
+#endif
+    for (; i < n; ++i) {
+        out[i] = a[i] + (static_cast<float>(b[i]) - a[i]) * t;
+    }
+}
+
+// appends the index of every v[i] >= threshold to out. detector score maps
+// are almost all background, so a compare + mask test skips 8 cells at a time
+inline void find_ge(const float* v, size_t n, float threshold, std::vector<int>& out) {
+    size_t i = 0;
+#if defined(__AVX__)
+    const __m256 vt = _mm256_set1_ps(threshold);
+    for (; i + 8 <= n; i += 8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(v + i), vt, _CMP_GE_OQ));
+        while (mask) {
+            out.push_back(static_cast<int>(i) + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t vt = vdupq_n_f32(threshold);
+    for (; i + 4 <= n; i += 4) {
+        if (vmaxvq_u32(vcgeq_f32(vld1q_f32(v + i), vt)) == 0) continue;
+        for (size_t k = i; k < i + 4; ++k) {
+            if (v[k] >= threshold) out.push_back(static_cast<int>(k));
+        }
+    }
+#elif defined(__SSE__)
+    const __m128 vt = _mm_set1_ps(threshold);
+    for (; i + 4 <= n; i += 4) {
+        int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(v + i), vt));
+        while (mask) {
+            out.push_back(static_cast<int>(i) + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (v[i] >= threshold) out.push_back(static_cast<int>(i));
+    }
+}
+
+}
+
+#endif
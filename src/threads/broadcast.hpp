@@ -0,0 +1,116 @@
+#ifndef BROADCAST_HPP
+#define BROADCAST_HPP
+
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../globals.hpp"
+
+namespace {
+
+// encodes a frame once, shared by every connected stream client
+std::shared_ptr<const EncodedFrame> encode_jpeg(const cv::Mat& frame, const std::vector<int>& params, uint64_t seq) {
+    auto buf = std::make_shared<EncodedFrame>();
+    buf->seq = seq;
+    try {
+        bool ok = cv::imencode(".jpg", frame, buf->jpeg, params);
+        if (!ok || buf->jpeg.empty()) {
+            std::cerr << "[broadcast] warning: frame encoding failed, skipping frame.\n";
+            return nullptr;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[broadcast] exception during imencode: " << e.what() << "\n";
+        return nullptr;
+    }
+    return buf;
+}
+
+}
+
+const std::vector<int> jpeg_params = { cv::IMWRITE_JPEG_QUALITY, 80 };
+
+// raw stream encode task, scheduled by main for every captured frame
+void encode_raw_stream(void) {
+    static uint64_t raw_seq = 0;
+    static std::chrono::steady_clock::time_point last_ring_time; // a frame encoded twice goes in the ring once
+
+    // nobody is watching and recordings come from the encoded ring, don't
+    // bother encoding
+    const bool fill_ring = !g_capture_passthrough.load();
+    if (g_raw_viewers.load() == 0 && !fill_ring) return;
+
+    // pooled frames are read-only once published, no copy needed
+    FrameHandle frame;
+    std::chrono::steady_clock::time_point capture_time;
+    { std::lock_guard<std::mutex> lock(g_streaming_buffer_mutex);
+        frame = g_streaming_buffer;
+        capture_time = g_streaming_buffer_time;
+    }
+    if (frame.empty()) return;
+
+    auto jpeg = encode_jpeg(frame.mat(), jpeg_params, raw_seq + 1);
+    if (!jpeg) return;
+    // the same jpeg is the pre-event history when there is no encoded branch,
+    // stamped with capture time so recordings keep the frames' real spacing
+    if (fill_ring && capture_time != last_ring_time) {
+        last_ring_time = capture_time;
+        const uint64_t pts = std::chrono::duration_cast<std::chrono::nanoseconds>(capture_time.time_since_epoch()).count();
+        g_jpeg_ring.push(jpeg->jpeg.data(), jpeg->jpeg.size(), pts, true, capture_time);
+    }
+    { std::lock_guard<std::mutex> lock(g_jpeg_mutex);
+        g_raw_jpeg = std::move(jpeg);
+    }
+    ++raw_seq;
+    g_jpeg_cv.notify_all();
+}
+
+// annotated stream encode task, scheduled by the embedding stage
+void encode_annotated_stream(void) {
+    static uint64_t annotated_seq = 0;
+    static cv::Mat annotated;
+
+    if (g_annotated_viewers.load() == 0) return;
+
+    DetectionResult result;
+    { std::lock_guard<std::mutex> lock(g_annotated_streaming_buffer_mutex);
+        result = g_annotated_streaming_buffer;
+    }
+    if (result.frame.empty()) return;
+
+    // draw into a reused scratch buffer instead of the shared frame
+    result.frame.mat().copyTo(annotated);
+    for (const FaceObject& fo : result.faces) {
+        cv::rectangle(annotated, fo.rect, cv::Scalar(0, 255, 0), 2);
+        if (!fo.name.empty()) {
+            cv::putText(annotated, fo.name, cv::Point(fo.rect.x, std::max(fo.rect.y - 6, 12)),
+                        cv::FONT_HERSHEY_SIMPLEX, 0.6, cv::Scalar(0, 255, 0), 2);
+        }
+    }
+
+    auto jpeg = encode_jpeg(annotated, jpeg_params, annotated_seq + 1);
+    if (!jpeg) return;
+    { std::lock_guard<std::mutex> lock(g_jpeg_mutex);
+        g_annotated_jpeg = std::move(jpeg);
+    }
+    ++annotated_seq;
+    g_jpeg_cv.notify_all();
+}
+
+// each stream encodes serially, so a burst of frames collapses into one
+// encode of the newest frame, but the two streams encode in parallel
+SerialTask& raw_broadcast_task() {
+    static SerialTask task(g_scheduler, encode_raw_stream);
+    return task;
+}
+
+SerialTask& annotated_broadcast_task() {
+    static SerialTask task(g_scheduler, encode_annotated_stream);
+    return task;
+}
+
+#endif
@@ -8,371 +8,211 @@
 #include <layer.h>
 
 #include "../types.hpp"
+#include "../inference.hpp"
+#include "../preprocess.hpp"
+#include "../retinaface.hpp"
+#include "../retinaface_postprocess.hpp"
+#include "embedding.hpp"
 
 #include <iostream>
 #include <string>
 #include <mutex>
 #include <array>
+#include <algorithm>
 
 #include "../globals.hpp"
 
-namespace { // https://github.com/Tencent/ncnn/blob/master/examples/retinaface.cpp
+namespace {
 
-static inline float intersection_area(const FaceObject& a, const FaceObject& b) {
-    cv::Rect_<float> inter = a.rect & b.rect;
-    return inter.area();
+// runs the network on a planar rgb float blob
+std::vector<FaceObject> retinaface_detect(const ncnn::Mat& in, InferenceContext& context) {
+    return g_retinaface_detector.detect(in, context);
 }
 
-static void qsort_descent_inplace(std::vector<FaceObject>& faceobjects, int left, int right) {
-    int i = left;
-    int j = right;
-    float p = faceobjects[(left + right) / 2].prob;
-
-    while (i <= j) {
-        while (faceobjects[i].prob > p) ++i;
-        while (faceobjects[j].prob < p) --j;
-
-        if (i <= j) {
-            // swap
-            std::swap(faceobjects[i], faceobjects[j]);
-
-            ++i;
-            --j;
-        }
-    }
-
-    #pragma omp parallel sections
-    {
-        #pragma omp section
-        {
-            if (left < j) qsort_descent_inplace(faceobjects, left, j);
-        }
-        #pragma omp section
-        {
-            if (i < right) qsort_descent_inplace(faceobjects, i, right);
-        }
-    }
+std::vector<FaceObject> retinaface_detect(const cv::Mat& frame, InferenceContext& context) {
+    // frame may be a roi of a larger image, honor its row stride
+    ncnn::Mat in = ncnn::Mat::from_pixels(frame.data, ncnn::Mat::PIXEL_BGR2RGB, frame.cols, frame.rows, static_cast<int>(frame.step), context.blob_allocator());
+    return retinaface_detect(in, context);
 }
 
-static void qsort_descent_inplace(std::vector<FaceObject>& faceobjects) {
-    if (faceobjects.empty()) return;
-    qsort_descent_inplace(faceobjects, 0, faceobjects.size() - 1);
 }
 
-static ncnn::Mat generate_anchors(int base_size, const ncnn::Mat& ratios, const ncnn::Mat& scales) {
-    int num_ratio = ratios.w;
-    int num_scale = scales.w;
-
-    ncnn::Mat anchors;
-    anchors.create(4, num_ratio * num_scale);
+std::vector<FaceObject> detect_faces(const cv::Mat& frame, InferenceContext& context) {
+    // resize, pad, swap to rgb and convert to float in one pass into the
+    // context's input blob. padding only goes up to the next multiple of the
+    // coarsest stride instead of a full square
+    const RetinaFaceConfig& config = g_retinaface_detector.config();
+    const int w = frame.cols;
+    const int h = frame.rows;
+    const Letterbox lb = letterbox_to_blob(frame, config.target_size, config.align, context.input);
 
-    const float cx = 0;
-    const float cy = 0;
-
-    for (int i = 0; i < num_ratio; ++i) {
-        float ar = ratios[i];
-
-        int r_w = round(base_size / sqrt(ar));
-        int r_h = round(r_w * ar); //round(base_size * sqrt(ar));
+    // detect faces
+    std::vector<FaceObject> detected_faces = retinaface_detect(context.input, context);
 
-        for (int j = 0; j < num_scale; ++j) {
-            float scale = scales[j];
+    // remap boxes and landmarks back to original image space
+    for (auto& face : detected_faces) {
+        float x0 = (face.rect.x - lb.pad_x) / lb.scale;
+        float y0 = (face.rect.y - lb.pad_y) / lb.scale;
+        float x1 = (face.rect.x + face.rect.width - lb.pad_x) / lb.scale;
+        float y1 = (face.rect.y + face.rect.height - lb.pad_y) / lb.scale;
 
-            float rs_w = r_w * scale;
-            float rs_h = r_h * scale;
+        // clip to original image size
+        x0 = std::max(std::min(x0, (float)w - 1), 0.f);
+        y0 = std::max(std::min(y0, (float)h - 1), 0.f);
+        x1 = std::max(std::min(x1, (float)w - 1), 0.f);
+        y1 = std::max(std::min(y1, (float)h - 1), 0.f);
 
-            float* anchor = anchors.row(i * num_scale + j);
+        face.rect.x = x0;
+        face.rect.y = y0;
+        face.rect.width = x1 - x0;
+        face.rect.height = y1 - y0;
 
-            anchor[0] = cx - rs_w * 0.5f;
-            anchor[1] = cy - rs_h * 0.5f;
-            anchor[2] = cx + rs_w * 0.5f;
-            anchor[3] = cy + rs_h * 0.5f;
+        for (cv::Point2f& p : face.landmarks) {
+            p.x = (p.x - lb.pad_x) / lb.scale;
+            p.y = (p.y - lb.pad_y) / lb.scale;
         }
     }
-
-    return anchors;
+    return detected_faces;
 }
 
-static void generate_proposals(const ncnn::Mat& anchors, int feat_stride, const ncnn::Mat& score_blob, const ncnn::Mat& bbox_blob, const ncnn::Mat& landmark_blob, float prob_threshold, std::vector<FaceObject>& faceobjects) {
-    int w = score_blob.w;
-    int h = score_blob.h;
-
-    const int num_anchors = anchors.h;
-
-    for (int q = 0; q < num_anchors; q++) {
-        const float* anchor = anchors.row(q);
-
-        const ncnn::Mat score = score_blob.channel(q + num_anchors);
-        const ncnn::Mat bbox = bbox_blob.channel_range(q * 4, 4);
-        const ncnn::Mat landmark = landmark_blob.channel_range(q * 10, 10);
-
-        // shifted anchor
-        float anchor_y = anchor[1];
-
-        float anchor_w = anchor[2] - anchor[0];
-        float anchor_h = anchor[3] - anchor[1];
-
-        for (int i = 0; i < h; i++) {
-            float anchor_x = anchor[0];
-
-            for (int j = 0; j < w; j++) {
-                int index = i * w + j;
-                float prob = score[index];
-
-                if (prob >= prob_threshold) {
-                    // apply center size
-                    float dx = bbox.channel(0)[index];
-                    float dy = bbox.channel(1)[index];
-                    float dw = bbox.channel(2)[index];
-                    float dh = bbox.channel(3)[index];
-
-                    float cx = anchor_x + anchor_w * 0.5f;
-                    float cy = anchor_y + anchor_h * 0.5f;
-
-                    float pb_cx = cx + anchor_w * dx;
-                    float pb_cy = cy + anchor_h * dy;
-
-                    float pb_w = anchor_w * exp(dw);
-                    float pb_h = anchor_h * exp(dh);
-
-                    float x0 = pb_cx - pb_w * 0.5f;
-                    float y0 = pb_cy - pb_h * 0.5f;
-                    float x1 = pb_cx + pb_w * 0.5f;
-                    float y1 = pb_cy + pb_h * 0.5f;
-
-                    FaceObject obj;
-                    obj.rect.x = x0;
-                    obj.rect.y = y0;
-                    obj.rect.width = x1 - x0 + 1;
-                    obj.rect.height = y1 - y0 + 1;
-                    obj.landmarks[0].x = cx + (anchor_w + 1) * landmark.channel(0)[index];
-                    obj.landmarks[0].y = cy + (anchor_h + 1) * landmark.channel(1)[index];
-                    obj.landmarks[1].x = cx + (anchor_w + 1) * landmark.channel(2)[index];
-                    obj.landmarks[1].y = cy + (anchor_h + 1) * landmark.channel(3)[index];
-                    obj.landmarks[2].x = cx + (anchor_w + 1) * landmark.channel(4)[index];
-                    obj.landmarks[2].y = cy + (anchor_h + 1) * landmark.channel(5)[index];
-                    obj.landmarks[3].x = cx + (anchor_w + 1) * landmark.channel(6)[index];
-                    obj.landmarks[3].y = cy + (anchor_h + 1) * landmark.channel(7)[index];
-                    obj.landmarks[4].x = cx + (anchor_w + 1) * landmark.channel(8)[index];
-                    obj.landmarks[4].y = cy + (anchor_h + 1) * landmark.channel(9)[index];
-                    obj.prob = prob;
-
-                    faceobjects.emplace_back(obj);
-                }
-
-                anchor_x += feat_stride;
+struct RoiParams {
+    bool enabled = true;
+    int tile_size = 640;         // full resolution tiles are at most this big
+    int tile_overlap = 64;       // so a face on a tile edge is whole in its neighbour
+    int max_tiles = 4;           // per frame, bounds the cost of the second pass
+    float margin = 0.25f;        // motion regions grow by this fraction on each side
+    float max_coarse_scale = 0.75f; // only worth it when the letterbox shrinks the frame more than this
+};
+
+// second pass for faces too small to survive the letterbox. active regions
+// are cut from the full resolution frame in tiles, detected at native scale
+// and merged with the coarse faces through nms. returns the tiles run
+int detect_faces_in_regions(const cv::Mat& frame, const std::vector<cv::Rect>& regions, const RoiParams& params,
+                            InferenceContext& context, std::vector<FaceObject>& faces) {
+    // the scale the coarse letterboxed pass ran at
+    const int target_size = g_retinaface_detector.config().target_size;
+    const float coarse_scale = std::min(target_size / (float)frame.cols, target_size / (float)frame.rows);
+    if (!params.enabled || regions.empty() || coarse_scale > params.max_coarse_scale) return 0;
+
+    thread_local std::vector<cv::Rect> tiles;
+    tiles.clear();
+    const cv::Rect bounds(0, 0, frame.cols, frame.rows);
+    const int tile = std::max(params.tile_size, params.tile_overlap + 32);
+    for (const cv::Rect& region : regions) {
+        const int mx = static_cast<int>(region.width * params.margin) + 16;
+        const int my = static_cast<int>(region.height * params.margin) + 16;
+        const cv::Rect padded = cv::Rect(region.x - mx, region.y - my, region.width + 2 * mx, region.height + 2 * my) & bounds;
+        if (padded.width < 64 || padded.height < 64) continue; // smaller than the coarsest anchor stride can use
+
+        // spread overlapping tiles evenly across regions bigger than one tile
+        const int step = tile - params.tile_overlap;
+        const int nx = padded.width <= tile ? 1 : (padded.width - tile + step - 1) / step + 1;
+        const int ny = padded.height <= tile ? 1 : (padded.height - tile + step - 1) / step + 1;
+        const int tw = std::min(tile, padded.width);
+        const int th = std::min(tile, padded.height);
+        for (int iy = 0; iy < ny; ++iy) {
+            for (int ix = 0; ix < nx; ++ix) {
+                const int x = padded.x + (nx == 1 ? 0 : ix * (padded.width - tw) / (nx - 1));
+                const int y = padded.y + (ny == 1 ? 0 : iy * (padded.height - th) / (ny - 1));
+                tiles.emplace_back(x, y, tw, th);
             }
-
-            anchor_y += feat_stride;
         }
     }
-}
-
-static void nms_sorted_bboxes(const std::vector<FaceObject>& faceobjects, std::vector<int>& picked, float nms_threshold) {
-    picked.clear();
-
-    const int n = faceobjects.size();
-
-    std::vector<float> areas(n);
-    for (int i = 0; i < n; ++i) {
-        areas[i] = faceobjects[i].rect.area();
-    }
 
-    for (int i = 0; i < n; ++i) {
-        const FaceObject& a = faceobjects[i];
-
-        int keep = 1;
-        for (int j = 0; j < (int)picked.size(); ++j) {
-            const FaceObject& b = faceobjects[picked[j]];
-
-            // intersection over union
-            float inter_area = intersection_area(a, b);
-            float union_area = areas[i] + areas[picked[j]] - inter_area;
-            if (inter_area / union_area > nms_threshold)
-                keep = 0;
+    // biggest areas of activity first
+    std::sort(tiles.begin(), tiles.end(), [](const cv::Rect& a, const cv::Rect& b) { return a.area() > b.area(); });
+    if (static_cast<int>(tiles.size()) > params.max_tiles) tiles.resize(params.max_tiles);
+
+    const size_t coarse_count = faces.size();
+    for (const cv::Rect& t : tiles) {
+        for (FaceObject& fo : retinaface_detect(frame(t), context)) {
+            fo.rect.x += t.x;
+            fo.rect.y += t.y;
+            for (cv::Point2f& p : fo.landmarks) {
+                p.x += t.x;
+                p.y += t.y;
+            }
+            faces.push_back(std::move(fo));
         }
-
-        if (keep) picked.push_back(i);
     }
-}
-
-std::vector<FaceObject> retinaface_detect(const cv::Mat& frame) {
-    ncnn::Extractor ex = g_retinaface_net.create_extractor();
-
-    const float prob_threshold = 0.8f;
-    const float nms_threshold = 0.4f;
-
-    std::vector<FaceObject> faceobjects;
-    int img_w = frame.cols;
-    int img_h = frame.rows;
-
-    ncnn::Mat in = ncnn::Mat::from_pixels(frame.data, ncnn::Mat::PIXEL_BGR2RGB, img_w, img_h);
-
-    ex.set_light_mode(true);
-    ex.input("data", in);
-
-    std::vector<FaceObject> faceproposals;
-
-    { // stride 32
-        ncnn::Mat score_blob, bbox_blob, landmark_blob;
-        ex.extract("face_rpn_cls_prob_reshape_stride32", score_blob);
-        ex.extract("face_rpn_bbox_pred_stride32", bbox_blob);
-        ex.extract("face_rpn_landmark_pred_stride32", landmark_blob);
-
-        const int base_size = 16;
-        const int feat_stride = 32;
-        ncnn::Mat ratios(1);
-        ratios[0] = 1.f;
-        ncnn::Mat scales(2);
-        scales[0] = 32.f;
-        scales[1] = 16.f;
-        ncnn::Mat anchors = generate_anchors(base_size, ratios, scales);
-
-        std::vector<FaceObject> faceobjects32;
-        generate_proposals(anchors, feat_stride, score_blob, bbox_blob, landmark_blob, prob_threshold, faceobjects32);
-
-        faceproposals.insert(faceproposals.end(), faceobjects32.begin(), faceobjects32.end());
-    }
-    { // stride 16
-        ncnn::Mat score_blob, bbox_blob, landmark_blob;
-        ex.extract("face_rpn_cls_prob_reshape_stride16", score_blob);
-        ex.extract("face_rpn_bbox_pred_stride16", bbox_blob);
-        ex.extract("face_rpn_landmark_pred_stride16", landmark_blob);
-
-        const int base_size = 16;
-        const int feat_stride = 16;
-        ncnn::Mat ratios(1);
-        ratios[0] = 1.f;
-        ncnn::Mat scales(2);
-        scales[0] = 8.f;
-        scales[1] = 4.f;
-        ncnn::Mat anchors = generate_anchors(base_size, ratios, scales);
-
-        std::vector<FaceObject> faceobjects16;
-        generate_proposals(anchors, feat_stride, score_blob, bbox_blob, landmark_blob, prob_threshold, faceobjects16);
-
-        faceproposals.insert(faceproposals.end(), faceobjects16.begin(), faceobjects16.end());
-    }
-    { // stride 8
-        ncnn::Mat score_blob, bbox_blob, landmark_blob;
-        ex.extract("face_rpn_cls_prob_reshape_stride8", score_blob);
-        ex.extract("face_rpn_bbox_pred_stride8", bbox_blob);
-        ex.extract("face_rpn_landmark_pred_stride8", landmark_blob);
-
-        const int base_size = 16;
-        const int feat_stride = 8;
-        ncnn::Mat ratios(1);
-        ratios[0] = 1.f;
-        ncnn::Mat scales(2);
-        scales[0] = 2.f;
-        scales[1] = 1.f;
-        ncnn::Mat anchors = generate_anchors(base_size, ratios, scales);
-
-        std::vector<FaceObject> faceobjects8;
-        generate_proposals(anchors, feat_stride, score_blob, bbox_blob, landmark_blob, prob_threshold, faceobjects8);
-
-        faceproposals.insert(faceproposals.end(), faceobjects8.begin(), faceobjects8.end());
-    }
-
-    // sort all proposals by score from highest to lowest
-    qsort_descent_inplace(faceproposals);
-
-    // apply nms with nms_threshold
-    std::vector<int> picked;
-    nms_sorted_bboxes(faceproposals, picked, nms_threshold);
-
-    int face_count = picked.size();
-
-    faceobjects.resize(face_count);
-    for (int i = 0; i < face_count; i++)
-    {
-        faceobjects[i] = faceproposals[picked[i]];
-
-        // clip to image size
-        float x0 = faceobjects[i].rect.x;
-        float y0 = faceobjects[i].rect.y;
-        float x1 = x0 + faceobjects[i].rect.width;
-        float y1 = y0 + faceobjects[i].rect.height;
-
-        x0 = std::max(std::min(x0, (float)img_w - 1), 0.f);
-        y0 = std::max(std::min(y0, (float)img_h - 1), 0.f);
-        x1 = std::max(std::min(x1, (float)img_w - 1), 0.f);
-        y1 = std::max(std::min(y1, (float)img_h - 1), 0.f);
-
-        faceobjects[i].rect.x = x0;
-        faceobjects[i].rect.y = y0;
-        faceobjects[i].rect.width = x1 - x0;
-        faceobjects[i].rect.height = y1 - y0;
-    }
-
-    return faceobjects;
-}
 
+    // the same face found by both passes or two overlapping tiles
+    if (faces.size() > coarse_count) retinaface::merge_faces(faces, 0.4f);
+    return static_cast<int>(tiles.size());
 }
 
+// for callers outside the scheduler, e.g. server request threads
 std::vector<FaceObject> detect_faces(const cv::Mat& frame) {
-    // preprocess frame
-    const int target_size = 640;
-    int w = frame.cols;
-    int h = frame.rows;
-    float scale = std::min(target_size / (float)w, target_size / (float)h);
-    int resized_w = static_cast<int>(w * scale);
-    int resized_h = static_cast<int>(h * scale);
-    int pad_x = (target_size - resized_w) / 2;
-    int pad_y = (target_size - resized_h) / 2;
-    cv::Mat processed_frame;
-    cv::resize(frame, processed_frame, cv::Size(resized_w, resized_h));
-    cv::copyMakeBorder(processed_frame, processed_frame, pad_y, target_size - resized_h - pad_y, pad_x, target_size - resized_w - pad_x, cv::BORDER_CONSTANT, cv::Scalar(0,0,0));
-
-    // detect faces
-    std::vector<FaceObject> detected_faces = retinaface_detect(processed_frame);
-
-    // remap boxes back to original image space
-    for (auto& face : detected_faces) {
-        float x0 = (face.rect.x - pad_x) / scale;
-        float y0 = (face.rect.y - pad_y) / scale;
-        float x1 = (face.rect.x + face.rect.width - pad_x) / scale;
-        float y1 = (face.rect.y + face.rect.height - pad_y) / scale;
-
-        // clip to original image size
-        x0 = std::max(std::min(x0, (float)w - 1), 0.f);
-        y0 = std::max(std::min(y0, (float)h - 1), 0.f);
-        x1 = std::max(std::min(x1, (float)w - 1), 0.f);
-        y1 = std::max(std::min(y1, (float)h - 1), 0.f);
-
-        face.rect.x = x0;
-        face.rect.y = y0;
-        face.rect.width = x1 - x0;
-        face.rect.height = y1 - y0;
-    }
-    return detected_faces;
+    thread_local InferenceContext context(g_retinaface_net);
+    return detect_faces(frame, context);
 }
 
-void detection_thread_func(void) {
-    g_exit_detection_thread.store(false);
-    std::cout << "[retina] info: starting face detection thread.\n";
+struct DetectionParams {
+    int max_in_flight = 2;    // detections running at once, bounds the reorder buffer
+    int threads_per_task = 2; // ncnn threads per detection
+    uint64_t interval = 5;    // while faces are tracked, run the detector every this many frames
+    RoiParams roi;            // full resolution pass over motion regions
+};
+
+// detection task, runs on the scheduler. takes the newest frame nobody has
+// claimed yet along with a ticket, results go back into ticket order before
+// reaching the embedding stage
+void detect_next_frame(const DetectionParams& params) {
+    // each scheduler worker keeps its own extractor and blob pools
+    thread_local InferenceContext context(g_retinaface_net, params.threads_per_task);
+
+    DetectionResult result;
+    uint64_t ticket;
+    { std::lock_guard<std::mutex> lock(g_frame_mutex);
+        // another task already took the newest frame
+        if (g_frame_seq == g_frame_dispatched_seq) return;
+
+        // frames captured while every detection slot was busy are never detected
+        if (g_frame_dispatched_seq != 0) g_detections_skipped.fetch_add(g_frame_seq - g_frame_dispatched_seq - 1);
+        g_frame_dispatched_seq = g_frame_seq;
+        ticket = g_detection_ticket++;
+        result.frame = g_frame;
+        result.seq = g_frame_seq;
+    }
     
-    ncnn::Extractor extractor = g_retinaface_net.create_extractor();
-
-    while (!g_exit_detection_thread.load()) {
-        cv::Mat frame;
-        { std::lock_guard<std::mutex> lock(g_frame_mutex);
-            if (g_frame.empty()) continue;
-            frame = g_frame.clone();
-        }
-        
-        std::vector<FaceObject> detected_faces = detect_faces(frame);
-        
-        DetectionResult result;
-        result.frame = std::move(frame);
-        result.faces = std::move(detected_faces);
-        { std::lock_guard<std::mutex> lock(g_embedding_buffer_mutex);
-            g_embedding_buffer.push(std::move(result));
-        }
-        g_embedding_buffer_cv.notify_one();
+    // skip inference on static scenes. while faces are in view the tracker
+    // carries their boxes between detector keyframes
+    MotionResult motion = g_motion_detector.update(result.frame.mat());
+    const bool tracking = g_faces_in_view.load();
+    // a concurrent task may already have stored a newer seq than ours
+    const uint64_t last = g_last_detection_seq.load();
+    const bool keyframe_due = result.seq > last && result.seq - last >= params.interval;
+    if (tracking && !motion.keyframe && !keyframe_due) {
+        g_detections_tracked.fetch_add(1);
+    } else if (tracking || motion.active || motion.keyframe) {
+        // only ever moves forward, an older task finishing late can't rewind it
+        uint64_t seen = g_last_detection_seq.load();
+        while (seen < result.seq && !g_last_detection_seq.compare_exchange_weak(seen, result.seq)) {}
+        result.faces = detect_faces(result.frame.mat(), context);
+        g_roi_tiles_run.fetch_add(detect_faces_in_regions(result.frame.mat(), motion.regions, params.roi, context, result.faces));
+        result.detected = true;
+        g_faces_in_view.store(!result.faces.empty());
+        g_detections_run.fetch_add(1);
+    } else {
+        g_detections_motion_skipped.fetch_add(1);
     }
 
-    std::cout << "[retina] info: exiting detection thread.\n";
+    // skipped frames still go through so the annotated stream keeps moving
+    g_detection_reorder.push(ticket, std::move(result), [](DetectionResult ready) {
+        g_embedding_buffer.push(std::move(ready));
+        embedding_task().schedule();
+    });
+}
+
+// called by main for every captured frame. at most max_in_flight detections
+// run at once, which also bounds the tickets the reorder buffer has to hold
+void schedule_detection(const DetectionParams& params) {
+    if (g_detections_in_flight.load() >= params.max_in_flight) return;
+    g_detections_in_flight.fetch_add(1);
+    g_scheduler.submit([params] {
+        detect_next_frame(params);
+        g_detections_in_flight.fetch_sub(1);
+    });
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -9,10 +9,15 @@
 
 #include "../types.hpp"
 #include "../utils.hpp"
+#include "../gallery.hpp"
+#include "../inference.hpp"
+#include "../tracker.hpp"
+#include "broadcast.hpp"
 
 #include <iostream>
 #include <mutex>
 #include <array>
+#include <utility>
 #include <condition_variable>
 
 #include "../globals.hpp"
@@ -61,7 +66,9 @@ std::vector<EmbeddingEntry> load_embedding_database(void) {
         is_done_cv.notify_one();
     };
     db_query.priority = SQLQuery::Priority::HIGH;
-    g_sql_queue.push(std::move(db_query));
+    { std::lock_guard<std::mutex> lock(g_sql_queue_mutex);
+        g_sql_queue.push(std::move(db_query));
+    }
     g_sql_queue_cv.notify_one();
 
     { std::unique_lock<std::mutex> lock(is_done_mutex);
@@ -72,89 +79,222 @@ std::vector<EmbeddingEntry> load_embedding_database(void) {
     return face_db;
 }
 
-std::vector<float> compute_feature_embedding(const cv::Mat& face) {
-    ncnn::Extractor ex = g_mobilefacenet_net.create_extractor();
-    
-    ncnn::Mat in = ncnn::Mat::from_pixels(face.data, ncnn::Mat::PIXEL_BGR2RGB, 112, 112);
-    
-    ex.set_light_mode(true);
-    ex.input("data", in);
-
-    ncnn::Mat feat;
-    if (ex.extract("fc1", feat) != 0) {
-        std::cerr << "[embed] error: failed to extract feature embedding." << std::endl;
-        return std::move(std::vector<float>());
+// builds the first gallery snapshot from the database
+void load_gallery(void) {
+    auto gallery = std::make_shared<const Gallery>(load_embedding_database());
+
+    std::lock_guard<std::mutex> lock(g_gallery_writer_mutex);
+    std::atomic_store(&g_gallery, gallery);
+    g_gallery_version.fetch_add(1);
+    std::cout << "[embed] info: gallery loaded with " << gallery->size() << " embeddings.\n";
+}
+
+// publishes the next gallery version with only the new entries added. readers
+// keep the snapshot they already hold until their next load
+void append_to_gallery(const std::vector<EmbeddingEntry>& entries) {
+    std::lock_guard<std::mutex> lock(g_gallery_writer_mutex);
+    std::shared_ptr<const Gallery> current = std::atomic_load(&g_gallery);
+    std::shared_ptr<const Gallery> next = current ? current->appended(entries) : std::make_shared<const Gallery>(entries);
+    std::atomic_store(&g_gallery, next);
+    g_gallery_version.fetch_add(1);
+    std::cout << "[embed] info: gallery version " << next->version() << " has " << next->size() << " embeddings.\n";
+}
+
+// the published gallery through a per-thread cache, so the common case is a
+// single atomic load of the version counter and readers never take a lock
+const std::shared_ptr<const Gallery>& gallery_snapshot(void) {
+    thread_local std::shared_ptr<const Gallery> cached;
+    thread_local uint64_t cached_version = UINT64_MAX;
+
+    uint64_t version = g_gallery_version.load();
+    if (version != cached_version) {
+        cached = std::atomic_load(&g_gallery);
+        cached_version = version;
     }
+    return cached;
+}
+
+// buffers reused across batches so steady-state embedding doesn't allocate.
+// one per thread or serial stage, never shared between concurrent callers
+struct EmbeddingContext {
+    EmbeddingContext() : inference(g_mobilefacenet_net) {}
+
+    InferenceContext inference;   // persistent MobileFaceNet extractor and blob pools
+    ncnn::Mat input;              // 112x112x3 planar rgb input blob
+    std::vector<cv::Mat> aligned; // aligned 112x112 bgr crops
+};
+
+// warps a detected face onto the reference landmarks, reusing the output mat
+void align_face(const cv::Mat& frame, const FaceObject& fo, cv::Mat& aligned) {
+    cv::Mat transform = cv::estimateAffinePartial2D(fo.landmarks, g_EMBEDDING_REFERENCE);
+    cv::warpAffine(frame, aligned, transform, cv::Size(112, 112), cv::INTER_LINEAR);
 
-    std::vector<float> embedding(feat.w);
-    float norm = 0.f;
-    for (int i = 0; i < feat.w; i++) {
-        embedding[i] = feat[i];
-        norm += embedding[i] * embedding[i];
+    if (aligned.cols != 112 || aligned.rows != 112)
+        cv::resize(aligned, aligned, cv::Size(112, 112));
+}
+
+// copies a bgr crop into the preallocated planar rgb input blob
+void fill_embedding_input(const cv::Mat& face, ncnn::Mat& in) {
+    if (in.w != 112 || in.h != 112 || in.c != 3) in.create(112, 112, 3);
+
+    float* r = in.channel(0);
+    float* g = in.channel(1);
+    float* b = in.channel(2);
+    for (int y = 0; y < 112; ++y) {
+        const uchar* p = face.ptr<uchar>(y);
+        const int offset = y * 112;
+        for (int x = 0; x < 112; ++x) {
+            b[offset + x] = p[3 * x + 0];
+            g[offset + x] = p[3 * x + 1];
+            r[offset + x] = p[3 * x + 2];
+        }
     }
-    norm = std::sqrt(norm);
-    for (int i = 0; i < feat.w; i++) {
-        embedding[i] /= norm;
+}
+
+// embeds the first count aligned crops back to back through the context's
+// extractor, writing normalized embeddings into out. returns false if any face failed
+bool compute_feature_embeddings(EmbeddingContext& context, size_t count, EmbeddingBatch& out) {
+    out.count = 0;
+    if (count == 0) return true;
+
+    for (size_t i = 0; i < count; ++i) {
+        ncnn::Extractor& ex = context.inference.begin();
+
+        fill_embedding_input(context.aligned[i], context.input);
+        ex.input("data", context.input);
+
+        ncnn::Mat feat;
+        if (ex.extract("fc1", feat) != 0) {
+            std::cerr << "[embed] error: failed to extract feature embedding." << std::endl;
+            return false;
+        }
+
+        if (out.dim != feat.w || out.data.size() < count * feat.w) {
+            out.dim = feat.w;
+            out.data.resize(count * feat.w);
+        }
+
+        float* embedding = out.row(i);
+        float norm = 0.f;
+        for (int k = 0; k < feat.w; k++) {
+            embedding[k] = feat[k];
+            norm += embedding[k] * embedding[k];
+        }
+        norm = std::sqrt(norm);
+        for (int k = 0; k < feat.w; k++) {
+            embedding[k] /= norm;
+        }
+        out.count = i + 1;
     }
 
-    return std::move(embedding);
+    return true;
 }
 
-void embedding_thread_func(void) {
-    g_exit_embedding_thread.store(false);
-    std::cout << "[embed] info: starting facial feature embedding thread.\n";
+std::vector<float> compute_feature_embedding(const cv::Mat& face) {
+    thread_local EmbeddingContext context;
+    if (context.aligned.empty()) context.aligned.emplace_back();
+    context.aligned[0] = face;
 
-    // load embedding db
-    std::vector<EmbeddingEntry> face_db = load_embedding_database();
+    thread_local EmbeddingBatch batch;
+    if (!compute_feature_embeddings(context, 1, batch)) {
+        return std::vector<float>();
+    }
+    return std::vector<float>(batch.row(0), batch.row(0) + batch.dim);
+}
 
-    while (!g_exit_embedding_thread.load()) {
-        DetectionResult retina;
-        { std::unique_lock<std::mutex> lock(g_embedding_buffer_mutex);
-            g_embedding_buffer_cv.wait(lock, [] {
-                return !g_embedding_buffer.empty() || g_should_reload_db.load() || g_exit_embedding_thread.load();
-            });
+SerialTask& embedding_task();
 
-            if (g_exit_embedding_thread.load()) break;
+// embedding stage, runs on the scheduler as a serial task so batches are
+// tracked, matched and published in capture order. faces are only embedded
+// when their track is new or seen noticeably better, the rest reuse the
+// identity cached on their track
+void embed_queued_detections(void) {
+    // parameters
+    const size_t max_batch_frames = 4; // drain up to this many queued detections per batch
+    const float match_threshold = 0.7f;
 
-            if (g_should_reload_db.load()) {
-                lock.unlock();
-                face_db = load_embedding_database();
-                g_should_reload_db.store(false);
-                continue;
-            }
+    // only ever touched by one run at a time
+    static FaceTracker tracker;
+    static EmbeddingContext context;
+    static EmbeddingBatch embeddings;
+    static std::vector<std::vector<GalleryMatch>> matches;
+    static std::vector<DetectionResult> batch;
+    static std::vector<std::pair<size_t, size_t>> to_embed; // (result, face) pairs
 
-            retina = g_embedding_buffer.front();
-            g_embedding_buffer.pop();
-        }
+    // batch whatever detection has queued up
+    batch.clear();
+    DetectionResult retina;
+    while (batch.size() < max_batch_frames && g_embedding_buffer.try_pop(retina)) {
+        batch.push_back(std::move(retina));
+    }
+    if (batch.empty()) return;
 
-        cv::Mat annotated = retina.frame.clone();
-        for (FaceObject& fo : retina.faces) {
-            // align face
-            cv::Mat transform = cv::estimateAffinePartial2D(fo.landmarks, g_EMBEDDING_REFERENCE);
-            cv::Mat aligned;
-            cv::warpAffine(retina.frame, aligned, transform, cv::Size(112, 112), cv::INTER_LINEAR);
+    // newly registered faces show up in the next snapshot, no reload needed
+    std::shared_ptr<const Gallery> gallery = gallery_snapshot();
+    const uint64_t gallery_version = g_gallery_version.load();
 
-            if (aligned.cols != 112 || aligned.rows != 112)
-                cv::resize(aligned, aligned, cv::Size(112, 112));
+    // tracks advance frame by frame, collecting the faces that need an embedding
+    to_embed.clear();
+    size_t detected_faces = 0;
+    for (size_t r = 0; r < batch.size(); ++r) {
+        DetectionResult& result = batch[r];
+        if (!result.detected) {
+            tracker.predict(result.seq, result.faces);
+            continue;
+        }
+        detected_faces += result.faces.size();
+        for (size_t f : tracker.update(result.faces, result.seq, gallery_version)) {
+            to_embed.emplace_back(r, f);
+        }
+    }
+    g_embeddings_cached.fetch_add(detected_faces - to_embed.size());
+
+    if (!to_embed.empty()) {
+        // align only the faces that need it
+        if (context.aligned.size() < to_embed.size()) context.aligned.resize(to_embed.size());
+        for (size_t i = 0; i < to_embed.size(); ++i) {
+            const DetectionResult& result = batch[to_embed[i].first];
+            align_face(result.frame.mat(), result.faces[to_embed[i].second], context.aligned[i]);
+        }
 
-            std::vector<float> embedding = compute_feature_embedding(aligned);
+        compute_feature_embeddings(context, to_embed.size(), embeddings);
+        g_embeddings_run.fetch_add(embeddings.count);
 
-            int match_count = 0;
-            for (size_t i = 0; i < face_db.size(); ++i) {
-                if (dot(embedding, face_db[i].embedding) > 0.7f) {
-                    // match
-                    ++match_count;
-                }
+        // match them against the gallery in one pass and cache the identity on the track
+        const bool searchable = gallery && static_cast<size_t>(embeddings.dim) == gallery->dim();
+        if (searchable) gallery->search_batch(embeddings.data.data(), embeddings.count, embeddings.dim, 1, matches);
+        for (size_t i = 0; i < embeddings.count; ++i) {
+            const FaceObject& fo = batch[to_embed[i].first].faces[to_embed[i].second];
+            std::string name;
+            if (searchable && !matches[i].empty() && matches[i][0].score > match_threshold) {
+                name = gallery->name(matches[i][0].index);
             }
-            cv::rectangle(annotated, fo.rect, cv::Scalar(0, 255, 0), 2);
+            tracker.set_identity(fo.track_id, name, FaceTracker::quality(fo), gallery_version);
         }
+    }
 
-        { std::lock_guard<std::mutex> lock(g_annotated_streaming_buffer_mutex);
-            g_annotated_streaming_buffer = std::move(annotated);
-        }
+    // every face in the batch takes its track's latest identity
+    for (DetectionResult& result : batch) {
+        for (FaceObject& fo : result.faces) fo.name = tracker.name(fo.track_id);
     }
 
-    std::cout << "[embed] info: exiting facial feature embedding thread.\n";
+    // recording follows whoever is in the newest frame, tracked or detected
+    g_recording_trigger.notify_detection(!batch.back().faces.empty());
+
+    // boxes are drawn by the broadcast task, the shared frame stays untouched
+    { std::lock_guard<std::mutex> lock(g_annotated_streaming_buffer_mutex);
+        g_annotated_streaming_buffer = std::move(batch.back());
+    }
+    batch.clear();
+    annotated_broadcast_task().schedule();
+
+    // more queued than one batch takes, go again
+    if (g_embedding_buffer.size() > 0) embedding_task().schedule();
+}
+
+SerialTask& embedding_task() {
+    static SerialTask task(g_scheduler, embed_queued_detections);
+    return task;
 }
 
 #endif
@@ -5,84 +5,170 @@
 
 #include <iostream>
 #include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "../recording_trigger.hpp"
+#include "../utils.hpp"
+#include "../video_encoder.hpp"
 
 #include "../globals.hpp"
 
-void recording_thread_func(const cv::Size frame_size) {
-    g_exit_recording_thread.store(false);
-    std::cout << "[rec] info: starting recording thread.\n";
+// one open recording, fed from whichever ring capture fills. passthrough
+// packets are muxed as they are, jpegs are decoded and re-encoded. the mp4
+// is cut into segments at a size or duration limit, passthrough cuts wait
+// for a keyframe so every segment plays on its own
+class Recording {
+public:
+    bool open(std::chrono::steady_clock::time_point since, cv::Size frame_size, int fps, const EncoderParams& params,
+              const RecordingParams& recording_params) {
+        passthrough_ = g_capture_passthrough.load();
+        ring_ = passthrough_ ? &g_encoded_ring : &g_jpeg_ring;
+        frame_size_ = frame_size;
+        fps_ = fps;
+        params_ = params;
+        recording_params_ = recording_params;
+        if (!open_segment()) return false;
+        next_ = ring_->keyframe_before(since);
+        return true;
+    }
 
-    // parameters
-    const float activate_time = 1; // seconds
-    const float deactivate_time = 2;
-    const float prerecord_buffer = 2;
-
-    const int fourcc = cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
-
-    bool is_first_found = false;
-    std::chrono::time_point<std::chrono::steady_clock> first_found_time;
-    while (!g_exit_recording_thread.load()) {
-        const int fps = g_fps.load();
-        if (fps < 1) continue;
-
-        // remove expired frames
-        const auto steady_now = std::chrono::steady_clock::now();
-        { std::lock_guard<std::mutex> lock(g_recording_buffer_mutex);
-            if (!g_recording_buffer.empty()) {
-                while ((steady_now - g_recording_buffer.front().steady_time) >= std::chrono::duration<float>(prerecord_buffer)) {
-                    g_recording_buffer.pop();
+    // writes everything the ring took in since the last drain. when the
+    // recorder fell so far behind that packets were evicted unread, the
+    // deltas after the gap are skipped up to the next keyframe
+    void drain() {
+        packets_.clear();
+        uint64_t lost = 0;
+        next_ = ring_->read_from(next_, packets_, &lost);
+        if (lost > 0) {
+            std::cerr << "[rec] warning: fell behind the pre-record ring, " << lost << " frames lost.\n";
+            g_recording_gaps.fetch_add(1);
+            g_recording_packets_lost.fetch_add(lost);
+            resync_ = true;
+        }
+        // more than one packet is a backlog, the pre-roll or a catch up, and
+        // waits for the encoder. a single live frame is dropped if it's full
+        const bool backlog = packets_.size() > 1;
+        for (const auto& packet : packets_) {
+            if (resync_) {
+                if (!packet->keyframe) {
+                    g_recording_packets_lost.fetch_add(1);
+                    continue;
                 }
+                resync_ = false;
             }
+            if (segment_full() && packet->keyframe) {
+                close_segment();
+                if (!open_segment()) return;
+            }
+            if (passthrough_) {
+                muxer_.write(packet);
+                continue;
+            }
+            FrameHandle frame = g_frame_pool.acquire();
+            cv::imdecode(cv::Mat(1, static_cast<int>(packet->data.size()), CV_8UC1, const_cast<uint8_t*>(packet->data.data())),
+                         cv::IMREAD_COLOR, &frame.writable());
+            encoder_.write(frame, packet->steady_time, backlog);
         }
+        if (passthrough_ || packets_.empty()) return;
 
-        // check if should start recording
-        if (g_should_record.load()) {
-            if (!is_first_found) {
-                // first head detected, start the timer
-                std::cout << "[rec] info: detected head, starting timer" << std::endl;
-                first_found_time = std::chrono::steady_clock::now();
-                is_first_found = true;
-            }
+        const EncoderStats stats = encoder_.stats();
+        g_recording_encode_latency_us.store(static_cast<uint64_t>(stats.mean_latency_ms * 1000));
+        g_recording_bitrate_kbps.store(static_cast<uint64_t>(stats.bitrate_kbps));
+        g_recording_frames_dropped.store(stats.frames_dropped);
+    }
 
-            // wait for detected for some period
-            if ((steady_now - first_found_time) >= std::chrono::duration<float>(activate_time)) {
-                // activate recording
-                std::string now_str = current_date_time_str();
-                std::cout << "[rec] info: starting recording at " << now_str << "\n";
-                std::cout << "[rec] info: writing recording to " << "rec/" << now_str <<  ".avi\n";
-                cv::VideoWriter video_writer = cv::VideoWriter("rec/" + now_str + ".avi", fourcc, fps, frame_size, true);
-                if (!video_writer.isOpened()) {
-                    std::cerr << "[rec] error: could not open video writer." << std::endl;
-                    return;
-                }
-                // keep recording until not
-                std::chrono::time_point<std::chrono::steady_clock> last_found_time = first_found_time;
-                while ((std::chrono::steady_clock::now() - last_found_time) <= std::chrono::duration<float>(deactivate_time)) {
-                    if (g_should_record.load()) {
-                        last_found_time = std::chrono::steady_clock::now();
-                    }
-                    // write all buffered data
-                    { std::unique_lock<std::mutex> lock(g_recording_buffer_mutex, std::defer_lock);
-                        while (!g_recording_buffer.empty()) {
-                            lock.lock();
-                            cv::Mat frame = g_recording_buffer.front().frame;
-                            g_recording_buffer.pop();
-                            lock.unlock();
-                            video_writer.write(frame);
-                        }
-                    }
-                }
+    void close() {
+        drain();
+        close_segment();
+    }
+
+private:
+    // segments are named for the time they start
+    bool open_segment() {
+        const std::string path = "rec/" + current_date_time_str() + ".mp4";
+        std::cout << "[rec] info: writing recording to " << path << "\n";
+        const bool opened = passthrough_ ? muxer_.open(path, params_.fragment_duration, g_storage_queue)
+                                         : encoder_.open(path, frame_size_, fps_, g_storage_queue, params_);
+        if (!opened) {
+            std::cerr << "[rec] error: could not open video writer." << std::endl;
+            return false;
+        }
+        segment_start_ = std::chrono::steady_clock::now();
+        open_ = true;
+        return true;
+    }
+
+    bool segment_full() const {
+        const uint64_t bytes = passthrough_ ? muxer_.muxed_bytes() : encoder_.muxed_bytes();
+        return bytes >= recording_params_.segment_bytes ||
+               std::chrono::steady_clock::now() - segment_start_ >= recording_params_.segment_duration;
+    }
+
+    void close_segment() {
+        if (!open_) return;
+        open_ = false;
+        if (passthrough_) {
+            muxer_.close();
+            std::cout << "[rec] info: ending segment at " << current_date_time_str() << ", " << muxer_.packets() << " frames, "
+                      << muxer_.bytes() / 1024 << " KiB passed through\n";
+            return;
+        }
+        encoder_.close();
+        const EncoderStats stats = encoder_.stats();
+        std::cout << "[rec] info: ending segment at " << current_date_time_str() << ", " << stats.frames_out << " frames, "
+                  << stats.bitrate_kbps << " kbps, encode latency " << stats.mean_latency_ms << " ms mean / "
+                  << stats.max_latency_ms << " ms max, " << stats.frames_dropped << " dropped\n";
+    }
+
+    bool passthrough_ = false;
+    bool open_ = false;
+    bool resync_ = false; // skipping to a keyframe after a gap
+    const PacketRing* ring_ = nullptr;
+    cv::Size frame_size_;
+    int fps_ = 1;
+    EncoderParams params_;
+    RecordingParams recording_params_;
+    std::chrono::steady_clock::time_point segment_start_;
+    PacketMuxer muxer_;
+    VideoEncoder encoder_;
+    uint64_t next_ = 0;
+    std::vector<std::shared_ptr<const EncodedPacket>> packets_;
+};
 
-                // end recording
-                std::cout << "[rec] info: ending recording at " << current_date_time_str() << "\n";
-                video_writer.release();
+// sleeps on g_recording_trigger, which frame and detection notifications
+// move through idle, arming, recording and cooldown
+void recording_thread_func(const cv::Size frame_size, const int fps) {
+    std::cout << "[rec] info: starting recording thread.\n";
+
+    EncoderParams encoder_params;
+
+    std::unique_ptr<Recording> recording;
+    while (true) {
+        const RecordingStep step = g_recording_trigger.wait();
+        if (step.stopped) break;
+
+        if (step.start) {
+            std::cout << "[rec] info: starting recording at " << current_date_time_str() << "\n";
+            // the measured rate is what the jpeg ring actually holds
+            const int measured_fps = g_fps.load();
+            recording.reset(new Recording());
+            if (!recording->open(step.since, frame_size, measured_fps > 0 ? measured_fps : fps, encoder_params,
+                                 g_recording_trigger.params())) {
+                recording.reset();
             }
-        } else {
-            is_first_found = false;
+        }
+        if (!recording) continue;
+
+        if (step.drain) recording->drain();
+        if (step.end) {
+            recording->close();
+            recording.reset();
         }
     }
     std::cout << "[rec] info: exiting recording thread.\n";
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -16,6 +16,7 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <memory>
 #include <string>
 #include <unordered_set>
 
@@ -82,6 +83,66 @@ void with_auth(const httplib::Request& req, httplib::Response& res, Handler hand
     handler();
 }
 
+// writes the shared jpeg published by the broadcast thread, no per-client encoding.
+// waits for a newer frame than the last one sent and never sends faster than max_fps,
+// a slow client always jumps to the latest frame instead of falling behind
+bool stream_jpeg(httplib::DataSink& sink, const std::shared_ptr<const EncodedFrame>& source, std::atomic<int>& viewers, int max_fps) {
+    viewers.fetch_add(1);
+
+    const auto min_frame_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(1.f / max_fps));
+    auto next_send_time = std::chrono::steady_clock::now();
+    uint64_t last_seq = 0;
+    uint64_t skipped_frames = 0;
+
+    while (sink.is_writable()) {
+        if (g_exit_server_thread.load()) break;
+
+        // pace to the client's frame rate
+        std::this_thread::sleep_until(next_send_time);
+
+        std::shared_ptr<const EncodedFrame> jpeg;
+        { std::unique_lock<std::mutex> lock(g_jpeg_mutex);
+            // wake periodically to notice closed sockets and shutdown
+            bool is_new = g_jpeg_cv.wait_for(lock, std::chrono::milliseconds(200), [&] {
+                return (source && source->seq > last_seq) || g_exit_server_thread.load();
+            });
+            if (!is_new || g_exit_server_thread.load()) continue;
+            jpeg = source;
+        }
+
+        if (last_seq != 0) skipped_frames += jpeg->seq - last_seq - 1;
+        last_seq = jpeg->seq;
+        next_send_time = std::chrono::steady_clock::now() + min_frame_interval;
+
+        std::string header = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " +
+                            std::to_string(jpeg->jpeg.size()) + "\r\n\r\n";
+        if (!sink.write(header.c_str(), header.size())) // header
+            break;
+        if (!sink.write(reinterpret_cast<const char*>(jpeg->jpeg.data()), jpeg->jpeg.size())) // jpeg data
+            break;
+        if (!sink.write("\r\n", 2)) // trailing newline
+            break;
+    }
+
+    viewers.fetch_sub(1);
+    std::cout << "[server] info: stream client disconnected, skipped " << skipped_frames << " frames.\n";
+    return true;
+}
+
+// reads the optional ?fps= query parameter for a stream
+int stream_max_fps(const httplib::Request& req) {
+    const int DEFAULT_MAX_FPS = 20;
+    const int LIMIT_MAX_FPS = 30;
+
+    if (!req.has_param("fps")) return DEFAULT_MAX_FPS;
+    try {
+        int fps = std::stoi(req.get_param_value("fps"));
+        return std::max(1, std::min(fps, LIMIT_MAX_FPS));
+    } catch (const std::exception&) {
+        return DEFAULT_MAX_FPS;
+    }
+}
+
 }
 
 void server_thread_func(void) {
@@ -160,6 +221,59 @@ void server_thread_func(void) {
         }, false);
     });
 
+    server.Get("/stats", [&](const httplib::Request& req, httplib::Response& res) {
+        with_auth(req, res, [&]() {
+            json j;
+            j["fps"] = g_fps.load();
+            j["detections_run"] = g_detections_run.load();
+            j["detections_skipped"] = g_detections_skipped.load();
+            j["detections_motion_skipped"] = g_detections_motion_skipped.load();
+            j["detections_tracked"] = g_detections_tracked.load();
+            j["roi_tiles_run"] = g_roi_tiles_run.load();
+            j["anchor_grids_cached"] = g_retinaface_detector.cached_grids();
+            j["embeddings_run"] = g_embeddings_run.load();
+            j["embeddings_cached"] = g_embeddings_cached.load();
+            j["embedding_queue_depth"] = g_embedding_buffer.size();
+            j["embedding_queue_capacity"] = g_embedding_buffer.capacity();
+            j["embedding_queue_high_water"] = g_embedding_buffer.high_water();
+            j["embedding_queue_dropped"] = g_embedding_buffer.dropped();
+            j["detections_in_flight"] = g_detections_in_flight.load();
+            j["scheduler_queued"] = g_scheduler.queued();
+            j["scheduler_steals"] = g_scheduler.steals();
+            j["recording_encode_latency_us"] = g_recording_encode_latency_us.load();
+            j["recording_bitrate_kbps"] = g_recording_bitrate_kbps.load();
+            j["recording_frames_dropped"] = g_recording_frames_dropped.load();
+            j["recording_gaps"] = g_recording_gaps.load();
+            j["recording_packets_lost"] = g_recording_packets_lost.load();
+            j["recording_state"] = recording_state_name(g_recording_trigger.state());
+            j["recordings"] = g_recording_trigger.recordings();
+            j["recording_passthrough"] = g_capture_passthrough.load();
+            j["storage_queue_depth"] = g_storage_queue.size();
+            j["storage_queue_capacity"] = g_storage_queue.capacity();
+            j["storage_queue_high_water"] = g_storage_queue.high_water();
+            j["storage_bytes_written"] = g_storage_bytes_written.load();
+            j["storage_segments"] = g_storage_segments.load();
+            j["storage_errors"] = g_storage_errors.load();
+            j["storage_max_write_ms"] = g_storage_max_write_ms.load();
+            j["storage_direct_io"] = g_storage_direct_io.load();
+            j["encoded_ring_bytes"] = g_encoded_ring.bytes();
+            j["encoded_ring_packets"] = g_encoded_ring.size();
+            j["encoded_ring_budget"] = g_encoded_ring.budget();
+            j["encoded_ring_span_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(g_encoded_ring.span()).count();
+            j["jpeg_ring_bytes"] = g_jpeg_ring.bytes();
+            j["jpeg_ring_packets"] = g_jpeg_ring.size();
+            j["jpeg_ring_budget"] = g_jpeg_ring.budget();
+            j["jpeg_ring_span_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(g_jpeg_ring.span()).count();
+            j["prerecord_rejected"] = g_encoded_ring.rejected() + g_jpeg_ring.rejected();
+
+            std::shared_ptr<const Gallery> gallery = gallery_snapshot();
+            j["gallery_version"] = gallery ? gallery->version() : 0;
+            j["gallery_size"] = gallery ? gallery->size() : 0;
+
+            res.set_content(j.dump(), "application/json");
+        }, false);
+    });
+
     // post endpoints
     server.Post("/login", [&](const httplib::Request& req, httplib::Response& res) {
         auto usr_it = req.params.find("usr");
@@ -210,36 +324,34 @@ void server_thread_func(void) {
                 return;
             }
 
-            auto db_faces = load_embedding_database();
-
             std::vector<FaceObject> detected_faces = detect_faces(img);
 
-            json j_response;
-            j_response["boxes"] = json::array();
-
+            // embed every face, then match them all against the shared in-memory gallery
+            thread_local EmbeddingContext context;
+            thread_local EmbeddingBatch embeddings;
+            if (context.aligned.size() < detected_faces.size()) context.aligned.resize(detected_faces.size());
             for (size_t i = 0; i < detected_faces.size(); ++i) {
-                const auto& fo = detected_faces[i];
-                const auto& r = fo.rect;
-
-                cv::Mat transform = cv::estimateAffinePartial2D(fo.landmarks, g_EMBEDDING_REFERENCE);
-                cv::Mat aligned;
-                cv::warpAffine(img, aligned, transform, cv::Size(112, 112), cv::INTER_LINEAR);
+                align_face(img, detected_faces[i], context.aligned[i]);
+            }
+            compute_feature_embeddings(context, detected_faces.size(), embeddings);
 
-                std::vector<float> embedding = compute_feature_embedding(aligned);
+            std::shared_ptr<const Gallery> gallery = gallery_snapshot();
+            std::vector<std::vector<GalleryMatch>> matches;
+            if (gallery && static_cast<size_t>(embeddings.dim) == gallery->dim()) {
+                gallery->search_batch(embeddings.data.data(), embeddings.count, embeddings.dim, 1, matches);
+            }
 
-                std::string best_guess;
-                float best_sim = -1.0f;
-                for (const auto& db_face : db_faces) {
-                    float dot_product = dot(embedding, db_face.embedding);
+            json j_response;
+            j_response["boxes"] = json::array();
 
-                    if (dot_product > best_sim) {
-                        best_sim = dot_product;
-                        best_guess = db_face.name;
-                    }
-                }
+            for (size_t i = 0; i < detected_faces.size(); ++i) {
+                const auto& r = detected_faces[i].rect;
 
                 const float threshold = 0.8f;
-                std::string guess_name = (best_sim > threshold) ? best_guess : "";
+                std::string guess_name;
+                if (i < matches.size() && !matches[i].empty() && matches[i][0].score > threshold) {
+                    guess_name = gallery->name(matches[i][0].index);
+                }
 
                 json j_box;
                 j_box["face_index"] = i;
@@ -313,6 +425,7 @@ void server_thread_func(void) {
                 }
             }
 
+            std::vector<EmbeddingEntry> new_entries;
             for (const auto& [face_index, name] : faces_to_register) {
                 FaceObject& fo = detected_faces[face_index];
 
@@ -321,6 +434,8 @@ void server_thread_func(void) {
                 cv::warpAffine(img, aligned, transform, cv::Size(112, 112), cv::INTER_LINEAR);
 
                 std::vector<float> embedding = compute_feature_embedding(aligned);
+                if (embedding.empty()) continue;
+                new_entries.push_back({ name, embedding });
 
                 SQLQuery insert_person_query;
                 insert_person_query.priority = SQLQuery::Priority::HIGH;
@@ -350,7 +465,8 @@ void server_thread_func(void) {
                 std::cout << "[server] info: registered face_index=" << face_index << ", name='" << name << "'.\n";
             }
 
-            g_should_reload_db.store(true);
+            // only the new embeddings go into the in-memory gallery
+            append_to_gallery(new_entries);
             res.set_content("Faces registered successfully", "text/plain");
         }, false);
     });
@@ -358,50 +474,12 @@ void server_thread_func(void) {
     // stream endpoints
     server.Get("/video_raw", [&](const httplib::Request& req, httplib::Response& res) {
         with_auth(req, res, [&]() {
+            const int max_fps = stream_max_fps(req);
             res.set_header("Content-Type", "multipart/x-mixed-replace; boundary=frame");
             res.set_content_provider(
                 "multipart/x-mixed-replace; boundary=frame",
-                [&](size_t offset, httplib::DataSink &sink) -> bool {
-                    // write data
-                    std::vector<uchar> buf;
-                    std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, 80 };
-
-                    while (sink.is_writable()) {
-                        if (g_exit_server_thread.load()) break;
-                        
-                        cv::Mat frame;
-                        { std::lock_guard<std::mutex> lock(g_streaming_buffer_mutex);
-                            if (!g_streaming_buffer.empty()) {
-                                frame = g_streaming_buffer.clone();
-                            } else {
-                                frame.release();
-                            }
-                        }
-                        if (frame.empty()) {
-                            continue;
-                        }
-                        
-                        try {
-                            bool ok = cv::imencode(".jpg", frame, buf, params);
-                            if (!ok || buf.empty()) {
-                                std::cerr << "[server] warning: frame encoding failed, skipping frame.\n";
-                                continue; // skip this frame
-                            }
-                        } catch (const std::exception& e) {
-                            std::cerr << "[server] exception during imencode: " << e.what() << "\n";
-                            continue;
-                        }
-
-                        std::string header = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " +
-                                            std::to_string(buf.size()) + "\r\n\r\n";
-                        if (!sink.write(header.c_str(), header.size())) // header
-                            break;
-                        if (!sink.write(reinterpret_cast<const char*>(buf.data()), buf.size())) // jpeg data
-                            break;
-                        if (!sink.write("\r\n", 2)) // trailing newline
-                            break;
-                    }
-                    return true;
+                [max_fps](size_t offset, httplib::DataSink &sink) -> bool {
+                    return stream_jpeg(sink, g_raw_jpeg, g_raw_viewers, max_fps);
                 }
             );
         }, false);
@@ -409,47 +487,12 @@ void server_thread_func(void) {
 
     server.Get("/video_annotated", [&](const httplib::Request& req, httplib::Response& res) {
         with_auth(req, res, [&]() {
+            const int max_fps = stream_max_fps(req);
             res.set_header("Content-Type", "multipart/x-mixed-replace; boundary=frame");
             res.set_content_provider(
                 "multipart/x-mixed-replace; boundary=frame",
-                [&](size_t offset, httplib::DataSink &sink) -> bool {
-                    // write data
-                    std::vector<uchar> buf;
-                    std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, 80 };
-
-                    while (sink.is_writable()) {
-                        if (g_exit_server_thread.load()) break;
-                        
-                        cv::Mat frame;
-                        { std::lock_guard<std::mutex> lock(g_annotated_streaming_buffer_mutex);
-                            if (!g_annotated_streaming_buffer.empty())
-                                frame = g_annotated_streaming_buffer.clone();
-                        }
-                        if (frame.empty()) {
-                            return true;
-                        }
-
-                        try {
-                            bool ok = cv::imencode(".jpg", frame, buf, params);
-                            if (!ok || buf.empty()) {
-                                std::cerr << "[server] warning: frame encoding failed, skipping frame.\n";
-                                continue; // skip this frame
-                            }
-                        } catch (const std::exception& e) {
-                            std::cerr << "[server] exception during imencode: " << e.what() << "\n";
-                            continue;
-                        }
-
-                        std::string header = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " +
-                                            std::to_string(buf.size()) + "\r\n\r\n";
-                        if (!sink.write(header.c_str(), header.size())) // header
-                            break;
-                        if (!sink.write(reinterpret_cast<const char*>(buf.data()), buf.size())) // jpeg data
-                            break;
-                        if (!sink.write("\r\n", 2)) // trailing newline
-                            break;
-                    }
-                    return true;
+                [max_fps](size_t offset, httplib::DataSink &sink) -> bool {
+                    return stream_jpeg(sink, g_annotated_jpeg, g_annotated_viewers, max_fps);
                 }
             );
         }, false);
@@ -492,6 +535,7 @@ void server_thread_func(void) {
 
     std::cout << "[server] info: exiting server thread.\n";
 
+    g_jpeg_cv.notify_all();
     server.stop();
     server_thread.join();
 }
@@ -0,0 +1,59 @@
+#ifndef THREADS_STORAGE_HPP
+#define THREADS_STORAGE_HPP
+
+#include "../segment_file.hpp"
+
+#include "../globals.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+// the only thread that touches the recording disk. muxers queue their
+// output on g_storage_queue, so a stalled card fills the queue instead of
+// holding up an encoder. runs until told to exit and the queue is empty
+void storage_thread_func(void) {
+    g_exit_storage_thread.store(false);
+    std::cout << "[storage] info: starting storage thread.\n";
+
+    SegmentFile file;
+    bool logged_direct = false;
+    StorageChunk chunk;
+    while (true) {
+        if (!g_storage_queue.wait_pop(chunk, [] { return g_exit_storage_thread.load(); })) {
+            if (g_exit_storage_thread.load()) break;
+            continue;
+        }
+
+        switch (chunk.op) {
+        case StorageChunk::Op::OPEN:
+            if (!file.open(chunk.path)) {
+                g_storage_errors.fetch_add(1);
+                break;
+            }
+            if (!logged_direct) {
+                std::cout << "[storage] info: writing segments " << (file.direct() ? "with" : "without") << " O_DIRECT.\n";
+                logged_direct = true;
+            }
+            g_storage_direct_io.store(file.direct());
+            break;
+        case StorageChunk::Op::WRITE:
+            if (!file.is_open()) break; // the open failed, drop the segment
+            if (!file.append(chunk.data.data(), chunk.data.size())) g_storage_errors.fetch_add(1);
+            break;
+        case StorageChunk::Op::CLOSE:
+            if (!file.is_open()) break;
+            if (!file.close()) g_storage_errors.fetch_add(1);
+            g_storage_segments.fetch_add(1);
+            g_storage_bytes_written.fetch_add(file.bytes());
+            g_storage_max_write_ms.store(std::max<uint64_t>(g_storage_max_write_ms.load(), static_cast<uint64_t>(file.max_write_ms())));
+            break;
+        }
+        chunk = StorageChunk();
+    }
+
+    if (file.is_open() && !file.close()) g_storage_errors.fetch_add(1);
+    std::cout << "[storage] info: exiting storage thread.\n";
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef TRACKER_HPP
+#define TRACKER_HPP
+
+#include <opencv2/opencv.hpp>
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct TrackerParams {
+    float iou_threshold = 0.3f;   // predicted box vs detection overlap needed to continue a track
+    int max_missed = 2;           // detector passes a track may go unmatched before it is dropped
+    uint64_t max_predict = 10;    // frames a track is extrapolated past its last detection
+    float quality_gain = 1.25f;   // re-embed once a face is this much better than its best embedding
+    float velocity_smoothing = 0.5f;
+};
+
+// iou + constant velocity tracker over detector output. tracks carry a
+// stable id and a cached identity so a face is embedded when it first
+// appears or is seen noticeably better, not on every detection. frames
+// have to be fed in capture order, seq is the capture sequence number
+class FaceTracker {
+public:
+    explicit FaceTracker(const TrackerParams& params = TrackerParams()) : params_(params) {}
+
+    // matches detections to tracks, starting new tracks for the rest.
+    // sets track_id on every face and returns the indices of faces whose
+    // identity should be (re)computed. gallery_version lets unknown faces
+    // be retried once new people are enrolled
+    const std::vector<size_t>& update(std::vector<FaceObject>& faces, uint64_t seq, uint64_t gallery_version) {
+        to_embed_.clear();
+
+        // best iou pairs first
+        pairs_.clear();
+        for (size_t t = 0; t < tracks_.size(); ++t) {
+            const cv::Rect2f predicted = predict_rect(tracks_[t], seq);
+            for (size_t f = 0; f < faces.size(); ++f) {
+                float overlap = iou(predicted, faces[f].rect);
+                if (overlap >= params_.iou_threshold) pairs_.push_back({ overlap, { t, f } });
+            }
+        }
+        std::sort(pairs_.begin(), pairs_.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        track_matched_.assign(tracks_.size(), false);
+        face_matched_.assign(faces.size(), false);
+        for (const auto& pair : pairs_) {
+            const size_t t = pair.second.first;
+            const size_t f = pair.second.second;
+            if (track_matched_[t] || face_matched_[f]) continue;
+            track_matched_[t] = true;
+            face_matched_[f] = true;
+            correct(tracks_[t], faces[f], seq);
+            assign(tracks_[t], faces[f], f, gallery_version);
+        }
+
+        // age out tracks the detector lost
+        for (size_t t = 0; t < tracks_.size(); ++t) {
+            if (!track_matched_[t]) ++tracks_[t].missed;
+        }
+        tracks_.erase(std::remove_if(tracks_.begin(), tracks_.end(),
+            [this](const Track& track) { return track.missed > params_.max_missed; }), tracks_.end());
+
+        for (size_t f = 0; f < faces.size(); ++f) {
+            if (face_matched_[f]) continue;
+            Track track;
+            track.id = next_id_++;
+            track.rect = faces[f].rect;
+            track.landmarks = faces[f].landmarks;
+            track.prob = faces[f].prob;
+            track.seq = seq;
+            tracks_.push_back(track);
+            assign(tracks_.back(), faces[f], f, gallery_version);
+        }
+        return to_embed_;
+    }
+
+    // boxes of live tracks extrapolated to seq, for frames the detector skipped
+    void predict(uint64_t seq, std::vector<FaceObject>& out) const {
+        out.clear();
+        for (const Track& track : tracks_) {
+            if (track.missed > 0 || seq - track.seq > params_.max_predict) continue;
+            const cv::Rect2f rect = predict_rect(track, seq);
+            const cv::Point2f shift = (rect.tl() + rect.br()) * 0.5f - (track.rect.tl() + track.rect.br()) * 0.5f;
+
+            FaceObject fo;
+            fo.prob = track.prob;
+            fo.rect = rect;
+            for (size_t i = 0; i < fo.landmarks.size(); ++i) fo.landmarks[i] = track.landmarks[i] + shift;
+            fo.name = track.name;
+            fo.track_id = track.id;
+            out.push_back(fo);
+        }
+    }
+
+    // records what embedding the face of track_id resolved to
+    void set_identity(int track_id, const std::string& name, float quality, uint64_t gallery_version) {
+        for (Track& track : tracks_) {
+            if (track.id != track_id) continue;
+            track.name = name;
+            track.best_quality = std::max(track.best_quality, quality);
+            track.gallery_version = gallery_version;
+            return;
+        }
+    }
+
+    // cached identity of a track, empty if unknown or gone
+    const std::string& name(int track_id) const {
+        static const std::string unknown;
+        for (const Track& track : tracks_) {
+            if (track.id == track_id) return track.name;
+        }
+        return unknown;
+    }
+
+    size_t size() const { return tracks_.size(); }
+
+    // larger, more confident faces give better embeddings
+    static float quality(const FaceObject& fo) {
+        return fo.prob * fo.rect.area();
+    }
+
+private:
+    struct Track {
+        int id = 0;
+        cv::Rect2f rect;          // as of the last matched detection
+        cv::Rect2f velocity;      // per frame change of x, y, width, height
+        std::array<cv::Point2f, 5> landmarks;
+        float prob = 0.f;
+        uint64_t seq = 0;         // frame of the last matched detection
+        int missed = 0;
+        std::string name;
+        float best_quality = 0.f; // 0 until the first embedding lands
+        uint64_t gallery_version = 0;
+    };
+
+    cv::Rect2f predict_rect(const Track& track, uint64_t seq) const {
+        if (seq <= track.seq) return track.rect;
+        const float dt = static_cast<float>(std::min<uint64_t>(seq - track.seq, params_.max_predict));
+        return cv::Rect2f(track.rect.x + track.velocity.x * dt, track.rect.y + track.velocity.y * dt,
+                          std::max(1.f, track.rect.width + track.velocity.width * dt),
+                          std::max(1.f, track.rect.height + track.velocity.height * dt));
+    }
+
+    void correct(Track& track, const FaceObject& fo, uint64_t seq) {
+        if (seq > track.seq) {
+            const float dt = static_cast<float>(seq - track.seq);
+            const float a = params_.velocity_smoothing;
+            const cv::Rect2f measured = fo.rect;
+            track.velocity.x = a * track.velocity.x + (1.f - a) * (measured.x - track.rect.x) / dt;
+            track.velocity.y = a * track.velocity.y + (1.f - a) * (measured.y - track.rect.y) / dt;
+            track.velocity.width = a * track.velocity.width + (1.f - a) * (measured.width - track.rect.width) / dt;
+            track.velocity.height = a * track.velocity.height + (1.f - a) * (measured.height - track.rect.height) / dt;
+        }
+        track.rect = fo.rect;
+        track.landmarks = fo.landmarks;
+        track.prob = fo.prob;
+        track.seq = seq;
+        track.missed = 0;
+    }
+
+    void assign(const Track& track, FaceObject& fo, size_t index, uint64_t gallery_version) {
+        fo.track_id = track.id;
+        fo.name = track.name;
+        const bool first = track.best_quality <= 0.f;
+        const bool better = quality(fo) > track.best_quality * params_.quality_gain;
+        const bool enrolled_since = track.name.empty() && track.gallery_version != gallery_version;
+        if (first || better || enrolled_since) to_embed_.push_back(index);
+    }
+
+    static float iou(const cv::Rect2f& a, const cv::Rect2f& b) {
+        const float inter = (a & b).area();
+        const float uni = a.area() + b.area() - inter;
+        return uni > 0.f ? inter / uni : 0.f;
+    }
+
+    TrackerParams params_;
+    std::vector<Track> tracks_;
+    int next_id_ = 1;
+
+    // scratch reused across updates
+    std::vector<std::pair<float, std::pair<size_t, size_t>>> pairs_;
+    std::vector<bool> track_matched_;
+    std::vector<bool> face_matched_;
+    std::vector<size_t> to_embed_;
+};
+
+#endif
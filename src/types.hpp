@@ -4,26 +4,45 @@
 #include <opencv2/opencv.hpp>
 #include <sqlite3.h>
 
+#include "frame_pool.hpp"
+
 #include <chrono>
 #include <array>
+#include <cstdint>
 #include <functional>
+#include <string>
+#include <vector>
 
-struct FrameEntry {
-    cv::Mat frame;
-    std::chrono::time_point<std::chrono::steady_clock> steady_time;
+struct EncodedFrame {
+    uint64_t seq; // increases by one for every frame published on a stream
+    std::vector<uchar> jpeg;
 };
 
 struct FaceObject {
     float prob;
     cv::Rect rect;
     std::array<cv::Point2f, 5> landmarks;
+    std::string name; // recognized identity, empty if unknown
+    int track_id = -1; // assigned by the tracker, -1 if untracked
 };
 
 struct DetectionResult {
-    cv::Mat frame;
+    FrameHandle frame;
+    uint64_t seq = 0;      // capture sequence number of frame
+    bool detected = false; // false if the detector skipped this frame
     std::vector<FaceObject> faces;
 };
 
+// row-major feature embeddings, one row per face
+struct EmbeddingBatch {
+    int dim = 0;
+    size_t count = 0;
+    std::vector<float> data;
+
+    float* row(size_t i) { return data.data() + i * dim; }
+    const float* row(size_t i) const { return data.data() + i * dim; }
+};
+
 struct EmbeddingEntry {
     std::string name;
     std::vector<float> embedding;
@@ -32,17 +32,20 @@ bool ends_with(const std::string& value, const std::string& ending) {
 }
 
 
+float dot(const float* a, const float* b, size_t n) {
+    float s = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+
 float dot(const std::vector<float>& a, const std::vector<float>& b) {
     if (a.size() != b.size()) {
         std::cerr << "error: dot product vector sizes do not match.\n";
         return 0;
     }
-
-    float s = 0.0f;
-    for (size_t i = 0; i < a.size(); ++i) {
-        s += a[i] * b[i];
-    }
-    return s;
+    return dot(a.data(), b.data(), a.size());
 }
 
 #endif
\ No newline at end of file
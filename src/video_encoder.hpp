@@ -0,0 +1,393 @@
+#ifndef VIDEO_ENCODER_HPP
+#define VIDEO_ENCODER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#include "bounded_queue.hpp"
+#include "frame_pool.hpp"
+#include "media_pipeline.hpp"
+#include "packet_ring.hpp"
+#include "segment_file.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct EncoderParams {
+    int bitrate_kbps = 4000;
+    std::chrono::milliseconds keyframe_interval{2000};
+    std::chrono::milliseconds fragment_duration{1000};  // mp4 fragment length, bounds what a crash loses
+    bool prefer_hardware = true;                         // v4l2h264enc when the board has one
+    int max_pending = 8;                                 // frames inside the pipeline before live ones are dropped
+};
+
+struct EncoderStats {
+    uint64_t frames_in = 0;
+    uint64_t frames_out = 0;
+    uint64_t frames_dropped = 0;
+    uint64_t bytes_out = 0;           // encoded h.264, before muxing
+    double mean_latency_ms = 0;       // push into appsrc to encoder output
+    double max_latency_ms = 0;
+    double bitrate_kbps = 0;          // over the stream so far
+};
+
+// gst-launch description of an h.264 encoder plus caps. hardware is
+// v4l2h264enc, otherwise x264enc tuned for live capture
+inline std::string h264_encoder_description(const EncoderParams& params, int fps, bool hardware) {
+    const int gop = std::max(1, static_cast<int>(params.keyframe_interval.count() * fps / 1000));
+    if (hardware) {
+        return "v4l2h264enc extra-controls=\"controls,video_bitrate=" + std::to_string(params.bitrate_kbps * 1000) +
+               ",h264_i_frame_period=" + std::to_string(gop) + ",repeat_sequence_header=1\" ! video/x-h264,level=(string)4";
+    }
+    return "x264enc tune=zerolatency speed-preset=ultrafast bitrate=" + std::to_string(params.bitrate_kbps) +
+           " key-int-max=" + std::to_string(gop) + " ! video/x-h264,profile=baseline";
+}
+
+// stands in for a filesink at the end of a muxing pipeline. mp4mux output is
+// copied into StorageChunks for the storage thread, which does the writing.
+// the queue blocks when full, so a stalled disk holds up this pipeline's
+// streaming thread and nothing upstream of the recording
+class StorageOutput {
+public:
+    // gst-launch tail that open() attaches to. streamable keeps mp4mux from
+    // seeking back to patch headers, which an appsink can't follow
+    static std::string description(std::chrono::milliseconds fragment_duration) {
+        return "mp4mux streamable=true fragment-duration=" + std::to_string(fragment_duration.count()) + " ! "
+               "appsink name=out sync=false async=false";
+    }
+
+    // starts a segment at path, call before the pipeline is started
+    bool open(MediaPipeline& pipeline, const std::string& path, BoundedQueue<StorageChunk>& queue) {
+        GstElement* sink = pipeline.element("out");
+        if (!sink) return false;
+        queue_ = &queue;
+        bytes_.store(0);
+        StorageChunk chunk;
+        chunk.op = StorageChunk::Op::OPEN;
+        chunk.path = path;
+        queue_->push(std::move(chunk));
+
+        GstAppSinkCallbacks callbacks = {};
+        callbacks.new_sample = &StorageOutput::on_sample;
+        gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, this, nullptr);
+        gst_object_unref(sink);
+        return true;
+    }
+
+    // ends the segment, call once the pipeline has drained or stopped
+    void close() {
+        if (!queue_) return;
+        StorageChunk chunk;
+        chunk.op = StorageChunk::Op::CLOSE;
+        queue_->push(std::move(chunk));
+        queue_ = nullptr;
+    }
+
+    uint64_t bytes() const { return bytes_.load(); } // muxed so far this segment
+
+private:
+    // streaming thread
+    static GstFlowReturn on_sample(GstAppSink* sink, gpointer user_data) {
+        StorageOutput* self = static_cast<StorageOutput*>(user_data);
+        GstSample* sample = gst_app_sink_pull_sample(sink);
+        if (!sample) return GST_FLOW_OK;
+        GstBuffer* buffer = gst_sample_get_buffer(sample);
+        GstMapInfo map;
+        if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+            StorageChunk chunk;
+            chunk.data.assign(map.data, map.data + map.size);
+            self->bytes_.fetch_add(map.size);
+            gst_buffer_unmap(buffer, &map);
+            self->queue_->push(std::move(chunk));
+        }
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+
+    BoundedQueue<StorageChunk>* queue_ = nullptr;
+    std::atomic<uint64_t> bytes_{0};
+};
+
+// h.264 into fragmented mp4 through a gstreamer appsrc pipeline. frames are
+// handed over without a copy, the pipeline holds a reference to the pooled
+// buffer until the encoder is done with it. timestamps come from capture
+// time, so a dropped frame leaves a gap instead of speeding the clip up. encode latency and bitrate are
+// measured on the encoder's output pad. not thread safe, one writer thread
+class VideoEncoder {
+public:
+    VideoEncoder() : pipeline_("rec") {}
+    VideoEncoder(const VideoEncoder&) = delete;
+    VideoEncoder& operator=(const VideoEncoder&) = delete;
+    ~VideoEncoder() { close(); }
+
+    bool open(const std::string& path, cv::Size size, int fps, BoundedQueue<StorageChunk>& storage,
+              const EncoderParams& params = EncoderParams()) {
+        close();
+        params_ = params;
+        fps_ = std::max(1, fps);
+        frame_bytes_ = static_cast<size_t>(size.width) * size.height * 3;
+        stats_ = EncoderStats();
+        params_.max_pending = std::clamp(params_.max_pending, 1, static_cast<int>(push_times_.size()) - 1);
+        push_times_.fill(PushTime());
+        latency_sum_ms_ = 0;
+        max_latency_ms_ = 0;
+        frames_out_.store(0);
+        bytes_out_.store(0);
+        last_pts_out_.store(0);
+        last_pts_in_ = 0;
+
+        // the pi 5 dropped the h.264 block, so x264 is the common case there
+        if (params.prefer_hardware && has_gst_element("v4l2h264enc")) {
+            if (launch(path, size, h264_encoder_description(params_, fps_, true), storage)) encoder_ = "v4l2h264enc";
+        }
+        if (!pipeline_.is_running() && launch(path, size, h264_encoder_description(params_, fps_, false), storage)) encoder_ = "x264enc";
+        if (!pipeline_.is_running()) return false;
+        std::cout << "[rec] info: encoding with " << encoder_ << " at " << params.bitrate_kbps << " kbps.\n";
+        return true;
+    }
+
+    bool is_open() const { return pipeline_.is_running(); }
+    const std::string& encoder_name() const { return encoder_; }
+    uint64_t muxed_bytes() const { return output_.bytes(); }
+
+    // queues a bgr frame of the size given to open, stamped with the time it
+    // was captured. with wait the call blocks while the pipeline is full, for
+    // draining a backlog such as the pre-roll. without it a frame that finds
+    // max_pending frames still unencoded is dropped, the encoder can't keep up
+    // live. returns false if the frame was dropped or the pipeline failed
+    bool write(const FrameHandle& frame, std::chrono::steady_clock::time_point capture_time, bool wait) {
+        if (!pipeline_.is_running() || frame.empty()) return false;
+        if (pipeline_.failed()) {
+            teardown();
+            return false;
+        }
+        const cv::Mat& mat = frame.mat();
+        if (!mat.isContinuous() || mat.total() * mat.elemSize() != frame_bytes_) return false;
+
+        if (!wait && stats_.frames_in - frames_out_.load() >= static_cast<uint64_t>(params_.max_pending)) {
+            ++stats_.frames_dropped;
+            return false;
+        }
+
+        // the first frame is time zero, later ones keep their capture spacing
+        if (stats_.frames_in == 0) base_time_ = capture_time;
+        GstClockTime pts = std::chrono::duration_cast<std::chrono::nanoseconds>(capture_time - base_time_).count();
+        if (stats_.frames_in > 0 && pts <= last_pts_in_) pts = last_pts_in_ + 1;
+        last_pts_in_ = pts;
+
+        // the handle rides along with the buffer and is released with it
+        FrameHandle* held = new FrameHandle(frame);
+        GstBuffer* buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, mat.data, frame_bytes_, 0, frame_bytes_,
+                                                        held, [](gpointer data) { delete static_cast<FrameHandle*>(data); });
+        GST_BUFFER_PTS(buffer) = pts;
+        GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale(1, GST_SECOND, fps_);
+        { std::lock_guard<std::mutex> lock(timing_mutex_);
+            push_times_[stats_.frames_in % push_times_.size()] = { pts, std::chrono::steady_clock::now() };
+        }
+        // blocks while appsrc holds max_pending frames
+        if (gst_app_src_push_buffer(GST_APP_SRC(appsrc_), buffer) != GST_FLOW_OK) return false; // takes the buffer either way
+        ++stats_.frames_in;
+        return true;
+    }
+
+    EncoderStats stats() const {
+        EncoderStats stats = stats_;
+        std::lock_guard<std::mutex> lock(timing_mutex_);
+        stats.frames_out = frames_out_.load();
+        stats.bytes_out = bytes_out_.load();
+        stats.mean_latency_ms = stats.frames_out ? latency_sum_ms_ / stats.frames_out : 0;
+        stats.max_latency_ms = max_latency_ms_;
+        const double seconds = (last_pts_out_.load() + gst_util_uint64_scale(1, GST_SECOND, fps_)) / static_cast<double>(GST_SECOND);
+        stats.bitrate_kbps = stats.frames_out ? stats.bytes_out * 8.0 / seconds / 1000.0 : 0;
+        return stats;
+    }
+
+    // flushes the encoder and finishes the last fragment
+    void close() {
+        if (!pipeline_.is_running()) return;
+        gst_app_src_end_of_stream(GST_APP_SRC(appsrc_));
+        pipeline_.wait_eos(5 * GST_SECOND);
+        teardown();
+    }
+
+private:
+    bool launch(const std::string& path, cv::Size size, const std::string& encoder, BoundedQueue<StorageChunk>& storage) {
+        const std::string description =
+            "appsrc name=src is-live=true format=time block=true max-bytes=" +
+            std::to_string(frame_bytes_ * params_.max_pending) + " "
+            "caps=video/x-raw,format=BGR,width=" + std::to_string(size.width) + ",height=" + std::to_string(size.height) +
+            ",framerate=" + std::to_string(fps_) + "/1 ! "
+            "videoconvert ! video/x-raw,format=I420 ! " + encoder + " ! "
+            "h264parse name=parse ! " + StorageOutput::description(params_.fragment_duration);
+        if (!pipeline_.launch(description)) return false;
+        appsrc_ = pipeline_.element("src");
+        if (!output_.open(pipeline_, path, storage)) {
+            teardown();
+            return false;
+        }
+
+        // encoder output lands on the parser's sink pad
+        GstElement* parse = pipeline_.element("parse");
+        GstPad* pad = gst_element_get_static_pad(parse, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, &VideoEncoder::on_encoded, this, nullptr);
+        gst_object_unref(pad);
+        gst_object_unref(parse);
+
+        if (!pipeline_.start()) {
+            teardown();
+            return false;
+        }
+        return true;
+    }
+
+    void teardown() {
+        if (appsrc_) gst_object_unref(appsrc_);
+        appsrc_ = nullptr;
+        pipeline_.stop();
+        output_.close();
+    }
+
+    // streaming thread
+    static GstPadProbeReturn on_encoded(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        VideoEncoder* self = static_cast<VideoEncoder*>(user_data);
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        if (!buffer) return GST_PAD_PROBE_OK;
+        self->bytes_out_.fetch_add(gst_buffer_get_size(buffer));
+
+        const GstClockTime pts = GST_BUFFER_PTS(buffer);
+        if (pts == GST_CLOCK_TIME_NONE) return GST_PAD_PROBE_OK; // stream headers
+        {
+            const auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(self->timing_mutex_);
+            for (const PushTime& push : self->push_times_) {
+                if (push.pts != pts) continue;
+                const double ms = std::chrono::duration<double, std::milli>(now - push.time).count();
+                self->latency_sum_ms_ += ms;
+                self->max_latency_ms_ = std::max(self->max_latency_ms_, ms);
+                break;
+            }
+        }
+        self->last_pts_out_.store(std::max<uint64_t>(self->last_pts_out_.load(), pts));
+        self->frames_out_.fetch_add(1);
+        return GST_PAD_PROBE_OK;
+    }
+
+    EncoderParams params_;
+    int fps_ = 1;
+    size_t frame_bytes_ = 0;
+    std::string encoder_;
+    MediaPipeline pipeline_;
+    GstElement* appsrc_ = nullptr;
+    StorageOutput output_;
+
+    EncoderStats stats_;                   // writer thread
+    std::atomic<uint64_t> frames_out_{0};  // streaming thread
+    std::atomic<uint64_t> bytes_out_{0};
+    mutable std::mutex timing_mutex_;
+    struct PushTime {
+        GstClockTime pts = GST_CLOCK_TIME_NONE;
+        std::chrono::steady_clock::time_point time;
+    };
+    std::array<PushTime, 64> push_times_{};  // by frame index, wider than max_pending
+    std::chrono::steady_clock::time_point base_time_; // writer thread
+    GstClockTime last_pts_in_ = 0;
+    std::atomic<uint64_t> last_pts_out_{0};  // streaming thread
+    double latency_sum_ms_ = 0;
+    double max_latency_ms_ = 0;
+};
+
+// writes h.264 access units that are already encoded into fragmented mp4,
+// for recordings cut straight from the capture encoder's stream. packets
+// are handed over without a copy and timestamps are rebased to the first
+// one, which should be a keyframe. not thread safe, one writer thread
+class PacketMuxer {
+public:
+    PacketMuxer() : pipeline_("rec") {}
+    PacketMuxer(const PacketMuxer&) = delete;
+    PacketMuxer& operator=(const PacketMuxer&) = delete;
+    ~PacketMuxer() { close(); }
+
+    bool open(const std::string& path, std::chrono::milliseconds fragment_duration, BoundedQueue<StorageChunk>& storage) {
+        close();
+        packets_ = 0;
+        bytes_ = 0;
+        const std::string description =
+            "appsrc name=src format=time block=true "
+            "caps=video/x-h264,stream-format=byte-stream,alignment=au ! "
+            "h264parse ! " + StorageOutput::description(fragment_duration);
+        if (!pipeline_.launch(description)) return false;
+        appsrc_ = pipeline_.element("src");
+        if (!output_.open(pipeline_, path, storage)) {
+            teardown();
+            return false;
+        }
+        if (!pipeline_.start()) {
+            teardown();
+            return false;
+        }
+        return true;
+    }
+
+    bool is_open() const { return pipeline_.is_running(); }
+
+    bool write(const std::shared_ptr<const EncodedPacket>& packet) {
+        if (!pipeline_.is_running()) return false;
+        if (pipeline_.failed()) {
+            teardown();
+            return false;
+        }
+        if (packets_ == 0) {
+            if (!packet->keyframe) return false; // nothing decodes before the first keyframe
+            base_pts_ = packet->pts;
+        }
+
+        // the packet is immutable and stays alive until the muxer lets go
+        auto* held = new std::shared_ptr<const EncodedPacket>(packet);
+        GstBuffer* buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, const_cast<uint8_t*>(packet->data.data()),
+                                                        packet->data.size(), 0, packet->data.size(), held,
+                                                        [](gpointer data) { delete static_cast<std::shared_ptr<const EncodedPacket>*>(data); });
+        GST_BUFFER_PTS(buffer) = packet->pts - base_pts_;
+        GST_BUFFER_DTS(buffer) = packet->pts - base_pts_; // the capture encoder emits no b-frames
+        if (gst_app_src_push_buffer(GST_APP_SRC(appsrc_), buffer) != GST_FLOW_OK) return false;
+        ++packets_;
+        bytes_ += packet->data.size();
+        return true;
+    }
+
+    void close() {
+        if (!pipeline_.is_running()) return;
+        gst_app_src_end_of_stream(GST_APP_SRC(appsrc_));
+        pipeline_.wait_eos(5 * GST_SECOND);
+        teardown();
+    }
+
+    uint64_t packets() const { return packets_; }
+    uint64_t bytes() const { return bytes_; }
+    uint64_t muxed_bytes() const { return output_.bytes(); }
+
+private:
+    void teardown() {
+        if (appsrc_) gst_object_unref(appsrc_);
+        appsrc_ = nullptr;
+        pipeline_.stop();
+        output_.close();
+    }
+
+    MediaPipeline pipeline_;
+    GstElement* appsrc_ = nullptr;
+    StorageOutput output_;
+    uint64_t base_pts_ = 0;
+    uint64_t packets_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+#endif
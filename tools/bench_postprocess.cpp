@@ -0,0 +1,267 @@
+#include <opencv2/opencv.hpp>
+
+#include <net.h>
+#include <mat.h>
+
+#include "../src/types.hpp"
+#include "../src/retinaface_postprocess.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// times retinaface post-processing on blobs recorded from one real forward
+// pass. the reference decoder from the ncnn example (what the detector used
+// before) runs against src/retinaface_postprocess.hpp on the same blobs
+//
+// usage: bench_postprocess <image> [iterations] [prob_threshold]
+// a low prob_threshold (e.g. 0.05) shows the crowded-scene worst case
+
+namespace { // https://github.com/Tencent/ncnn/blob/master/examples/retinaface.cpp
+
+struct RecordedStride {
+    int feat_stride;
+    float scales[2];
+    ncnn::Mat score_blob, bbox_blob, landmark_blob;
+    retinaface::AnchorGrid grid;  // built once, like the detector does at model load
+};
+
+static inline float intersection_area(const FaceObject& a, const FaceObject& b) {
+    cv::Rect_<float> inter = a.rect & b.rect;
+    return inter.area();
+}
+
+static void qsort_descent_inplace(std::vector<FaceObject>& faceobjects, int left, int right) {
+    int i = left;
+    int j = right;
+    float p = faceobjects[(left + right) / 2].prob;
+
+    while (i <= j) {
+        while (faceobjects[i].prob > p) ++i;
+        while (faceobjects[j].prob < p) --j;
+
+        if (i <= j) {
+            std::swap(faceobjects[i], faceobjects[j]);
+            ++i;
+            --j;
+        }
+    }
+
+    #pragma omp parallel sections
+    {
+        #pragma omp section
+        {
+            if (left < j) qsort_descent_inplace(faceobjects, left, j);
+        }
+        #pragma omp section
+        {
+            if (i < right) qsort_descent_inplace(faceobjects, i, right);
+        }
+    }
+}
+
+static void nms_sorted_bboxes(const std::vector<FaceObject>& faceobjects, std::vector<int>& picked, float nms_threshold) {
+    picked.clear();
+    const int n = faceobjects.size();
+    std::vector<float> areas(n);
+    for (int i = 0; i < n; ++i) areas[i] = faceobjects[i].rect.area();
+
+    for (int i = 0; i < n; ++i) {
+        const FaceObject& a = faceobjects[i];
+        int keep = 1;
+        for (int j = 0; j < (int)picked.size(); ++j) {
+            const FaceObject& b = faceobjects[picked[j]];
+            float inter_area = intersection_area(a, b);
+            float union_area = areas[i] + areas[picked[j]] - inter_area;
+            if (inter_area / union_area > nms_threshold) keep = 0;
+        }
+        if (keep) picked.push_back(i);
+    }
+}
+
+static ncnn::Mat generate_anchors(int base_size, const ncnn::Mat& ratios, const ncnn::Mat& scales) {
+    int num_ratio = ratios.w;
+    int num_scale = scales.w;
+
+    ncnn::Mat anchors;
+    anchors.create(4, num_ratio * num_scale);
+
+    for (int i = 0; i < num_ratio; ++i) {
+        float ar = ratios[i];
+        int r_w = round(base_size / sqrt(ar));
+        int r_h = round(r_w * ar);
+        for (int j = 0; j < num_scale; ++j) {
+            float rs_w = r_w * scales[j];
+            float rs_h = r_h * scales[j];
+            float* anchor = anchors.row(i * num_scale + j);
+            anchor[0] = -rs_w * 0.5f;
+            anchor[1] = -rs_h * 0.5f;
+            anchor[2] = rs_w * 0.5f;
+            anchor[3] = rs_h * 0.5f;
+        }
+    }
+    return anchors;
+}
+
+static ncnn::Mat stride_anchors(const RecordedStride& stride) {
+    ncnn::Mat ratios(1);
+    ratios[0] = 1.f;
+    ncnn::Mat scales(2);
+    scales[0] = stride.scales[0];
+    scales[1] = stride.scales[1];
+    return generate_anchors(16, ratios, scales);
+}
+
+static void reference_generate_proposals(const ncnn::Mat& anchors, int feat_stride, const ncnn::Mat& score_blob, const ncnn::Mat& bbox_blob, const ncnn::Mat& landmark_blob, float prob_threshold, std::vector<FaceObject>& faceobjects) {
+    int w = score_blob.w;
+    int h = score_blob.h;
+    const int num_anchors = anchors.h;
+
+    for (int q = 0; q < num_anchors; q++) {
+        const float* anchor = anchors.row(q);
+        const ncnn::Mat score = score_blob.channel(q + num_anchors);
+        const ncnn::Mat bbox = bbox_blob.channel_range(q * 4, 4);
+        const ncnn::Mat landmark = landmark_blob.channel_range(q * 10, 10);
+
+        float anchor_y = anchor[1];
+        float anchor_w = anchor[2] - anchor[0];
+        float anchor_h = anchor[3] - anchor[1];
+
+        for (int i = 0; i < h; i++) {
+            float anchor_x = anchor[0];
+            for (int j = 0; j < w; j++) {
+                int index = i * w + j;
+                float prob = score[index];
+                if (prob >= prob_threshold) {
+                    float dx = bbox.channel(0)[index];
+                    float dy = bbox.channel(1)[index];
+                    float dw = bbox.channel(2)[index];
+                    float dh = bbox.channel(3)[index];
+
+                    float cx = anchor_x + anchor_w * 0.5f;
+                    float cy = anchor_y + anchor_h * 0.5f;
+                    float pb_cx = cx + anchor_w * dx;
+                    float pb_cy = cy + anchor_h * dy;
+                    float pb_w = anchor_w * exp(dw);
+                    float pb_h = anchor_h * exp(dh);
+
+                    float x0 = pb_cx - pb_w * 0.5f;
+                    float y0 = pb_cy - pb_h * 0.5f;
+                    float x1 = pb_cx + pb_w * 0.5f;
+                    float y1 = pb_cy + pb_h * 0.5f;
+
+                    FaceObject obj;
+                    obj.rect.x = x0;
+                    obj.rect.y = y0;
+                    obj.rect.width = x1 - x0 + 1;
+                    obj.rect.height = y1 - y0 + 1;
+                    for (int k = 0; k < 5; ++k) {
+                        obj.landmarks[k].x = cx + (anchor_w + 1) * landmark.channel(2 * k)[index];
+                        obj.landmarks[k].y = cy + (anchor_h + 1) * landmark.channel(2 * k + 1)[index];
+                    }
+                    obj.prob = prob;
+                    faceobjects.emplace_back(obj);
+                }
+                anchor_x += feat_stride;
+            }
+            anchor_y += feat_stride;
+        }
+    }
+}
+
+static size_t reference_postprocess(const std::vector<RecordedStride>& strides, float prob_threshold) {
+    std::vector<FaceObject> proposals;
+    for (const RecordedStride& stride : strides) {
+        std::vector<FaceObject> stride_proposals;
+        reference_generate_proposals(stride_anchors(stride), stride.feat_stride, stride.score_blob, stride.bbox_blob, stride.landmark_blob, prob_threshold, stride_proposals);
+        proposals.insert(proposals.end(), stride_proposals.begin(), stride_proposals.end());
+    }
+    if (!proposals.empty()) qsort_descent_inplace(proposals, 0, proposals.size() - 1);
+    std::vector<int> picked;
+    nms_sorted_bboxes(proposals, picked, 0.4f);
+    return picked.size();
+}
+
+static size_t new_postprocess(const std::vector<RecordedStride>& strides, float prob_threshold) {
+    thread_local std::vector<retinaface::Proposal> proposals;
+    thread_local std::vector<int> picked;
+    proposals.clear();
+    for (const RecordedStride& stride : strides) {
+        retinaface::generate_proposals(stride.grid, stride.score_blob, stride.bbox_blob, stride.landmark_blob, prob_threshold, proposals);
+    }
+    retinaface::sort_top_k(proposals, 500);
+    retinaface::nms(proposals, 0.4f, 64, picked);
+    return picked.size();
+}
+
+template <typename Fn>
+double time_us(int iterations, Fn fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) fn();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <image> [iterations] [prob_threshold]\n";
+        return 1;
+    }
+    const int iterations = argc > 2 ? std::max(1, std::stoi(argv[2])) : 1000;
+    const float prob_threshold = argc > 3 ? std::stof(argv[3]) : 0.8f;
+
+    cv::Mat image = cv::imread(argv[1]);
+    if (image.empty()) {
+        std::cerr << "[bench] error: could not read " << argv[1] << "\n";
+        return 1;
+    }
+
+    ncnn::Net net;
+    if (net.load_param("models/retinaface/mnet.25-opt.param") != 0 ||
+            net.load_model("models/retinaface/mnet.25-opt.bin") != 0) {
+        std::cerr << "[bench] error: failed to load RetinaFace model.\n";
+        return 1;
+    }
+
+    // record the output blobs of one forward pass on the letterboxed image
+    const int target_size = 640;
+    const float scale = std::min(target_size / (float)image.cols, target_size / (float)image.rows);
+    const int resized_w = static_cast<int>(image.cols * scale);
+    const int resized_h = static_cast<int>(image.rows * scale);
+    const int pad_x = (target_size - resized_w) / 2;
+    const int pad_y = (target_size - resized_h) / 2;
+    cv::Mat letterboxed;
+    cv::resize(image, letterboxed, cv::Size(resized_w, resized_h));
+    cv::copyMakeBorder(letterboxed, letterboxed, pad_y, target_size - resized_h - pad_y, pad_x, target_size - resized_w - pad_x, cv::BORDER_CONSTANT, cv::Scalar(0, 0, 0));
+
+    ncnn::Extractor ex = net.create_extractor();
+    ex.input("data", ncnn::Mat::from_pixels(letterboxed.data, ncnn::Mat::PIXEL_BGR2RGB, target_size, target_size));
+    std::vector<RecordedStride> strides = { { 32, { 32.f, 16.f } }, { 16, { 8.f, 4.f } }, { 8, { 2.f, 1.f } } };
+    for (RecordedStride& stride : strides) {
+        const std::string suffix = "_stride" + std::to_string(stride.feat_stride);
+        ex.extract(("face_rpn_cls_prob_reshape" + suffix).c_str(), stride.score_blob);
+        ex.extract(("face_rpn_bbox_pred" + suffix).c_str(), stride.bbox_blob);
+        ex.extract(("face_rpn_landmark_pred" + suffix).c_str(), stride.landmark_blob);
+        stride.grid = retinaface::make_anchor_grid(16, { stride.scales[0], stride.scales[1] }, stride.feat_stride, stride.score_blob.w, stride.score_blob.h);
+    }
+
+    const size_t reference_faces = reference_postprocess(strides, prob_threshold);
+    const size_t new_faces = new_postprocess(strides, prob_threshold);
+
+    const double reference_us = time_us(iterations, [&] { reference_postprocess(strides, prob_threshold); });
+    const double new_us = time_us(iterations, [&] { new_postprocess(strides, prob_threshold); });
+
+    std::cout << "[bench] info: prob_threshold " << prob_threshold << ", " << iterations << " iterations.\n";
+    std::cout << "[bench] info: reference " << reference_us << " us/frame, " << reference_faces << " faces.\n";
+    std::cout << "[bench] info: optimized " << new_us << " us/frame, " << new_faces << " faces.\n";
+    std::cout << "[bench] info: speedup " << reference_us / new_us << "x.\n";
+    if (reference_faces != new_faces) {
+        std::cerr << "[bench] warning: face counts differ.\n";
+    }
+    return 0;
+}
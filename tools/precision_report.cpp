@@ -0,0 +1,263 @@
+#include <opencv2/opencv.hpp>
+
+#include <net.h>
+#include <mat.h>
+
+#include "../src/types.hpp"
+#include "../src/precision.hpp"
+#include "../src/inference.hpp"
+#include "../src/preprocess.hpp"
+#include "../src/retinaface.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// accuracy versus latency of each precision both networks can be loaded at.
+// prints a markdown report to stdout, progress goes to stderr
+//
+// usage: precision_report <faces_dir> [frames_dir] [match_threshold]
+//   faces_dir        aligned 112x112 crops, one subdirectory per person
+//   frames_dir       camera frames to compare retinaface on (optional)
+//   match_threshold  cosine similarity for a match, 0.7 like the embedding stage
+//
+// the fp32 models are the reference. a precision keeps the threshold if
+// genuine pairs still match as often and impostor pairs don't match more
+
+namespace {
+
+struct Face {
+    int person;
+    cv::Mat crop;
+};
+
+struct FaceStats {
+    double ms_per_face = 0;
+    double tar = 0;              // genuine pairs above the threshold
+    double far = 0;              // impostor pairs above the threshold
+    double min_fp32_cosine = 1;  // worst agreement with the fp32 embedding
+    double mean_fp32_cosine = 0;
+};
+
+struct FrameStats {
+    double ms_per_frame = 0;
+    size_t faces = 0;
+    double fp32_recall = 0;      // fp32 faces found again at iou >= 0.5
+};
+
+std::vector<fs::path> images_under(const fs::path& dir) {
+    std::vector<fs::path> paths;
+    for (const auto& entry : fs::recursive_directory_iterator(dir)) {
+        if (!entry.is_regular_file()) continue;
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (ext == ".png" || ext == ".jpg" || ext == ".jpeg") paths.push_back(entry.path());
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+std::vector<Face> load_faces(const fs::path& dir) {
+    std::vector<fs::path> people;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (entry.is_directory()) people.push_back(entry.path());
+    }
+    std::sort(people.begin(), people.end());
+
+    std::vector<Face> faces;
+    for (size_t p = 0; p < people.size(); ++p) {
+        for (const fs::path& path : images_under(people[p])) {
+            cv::Mat crop = cv::imread(path.string());
+            if (crop.empty()) continue;
+            if (crop.cols != 112 || crop.rows != 112) cv::resize(crop, crop, cv::Size(112, 112));
+            faces.push_back({ static_cast<int>(p), crop });
+        }
+    }
+    return faces;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+using Embedding = std::vector<float>;
+
+float dot(const Embedding& a, const Embedding& b) {
+    float sum = 0.f;
+    for (size_t k = 0; k < a.size(); ++k) sum += a[k] * b[k];
+    return sum;
+}
+
+// normalized embedding of every face
+std::vector<Embedding> embed(const ncnn::Net& net, const std::vector<Face>& faces, double& ms_per_face) {
+    InferenceContext context(net, 4);
+    std::vector<Embedding> embeddings;
+    const auto start = std::chrono::steady_clock::now();
+    for (const Face& face : faces) {
+        ncnn::Extractor& ex = context.begin();
+        ex.input("data", ncnn::Mat::from_pixels(face.crop.data, ncnn::Mat::PIXEL_BGR2RGB, 112, 112, context.blob_allocator()));
+        ncnn::Mat feat;
+        ex.extract("fc1", feat);
+        Embedding embedding(feat.w);
+        float norm = 0.f;
+        for (int k = 0; k < feat.w; ++k) {
+            embedding[k] = feat[k];
+            norm += embedding[k] * embedding[k];
+        }
+        norm = std::sqrt(norm);
+        for (float& value : embedding) value /= norm;
+        embeddings.push_back(std::move(embedding));
+    }
+    ms_per_face = faces.empty() ? 0 : elapsed_ms(start) / faces.size();
+    return embeddings;
+}
+
+FaceStats face_stats(const std::vector<Face>& faces, const std::vector<Embedding>& embeddings, const std::vector<Embedding>& reference,
+                     double ms_per_face, float threshold) {
+    FaceStats stats;
+    stats.ms_per_face = ms_per_face;
+    size_t genuine = 0, genuine_hits = 0, impostor = 0, impostor_hits = 0;
+    for (size_t i = 0; i < faces.size(); ++i) {
+        for (size_t j = i + 1; j < faces.size(); ++j) {
+            const bool hit = dot(embeddings[i], embeddings[j]) > threshold;
+            if (faces[i].person == faces[j].person) {
+                ++genuine;
+                genuine_hits += hit;
+            } else {
+                ++impostor;
+                impostor_hits += hit;
+            }
+        }
+        const double cosine = dot(embeddings[i], reference[i]);
+        stats.min_fp32_cosine = std::min(stats.min_fp32_cosine, cosine);
+        stats.mean_fp32_cosine += cosine / faces.size();
+    }
+    stats.tar = genuine ? static_cast<double>(genuine_hits) / genuine : 0;
+    stats.far = impostor ? static_cast<double>(impostor_hits) / impostor : 0;
+    return stats;
+}
+
+std::vector<std::vector<FaceObject>> detect(const ncnn::Net& net, const std::vector<cv::Mat>& frames, double& ms_per_frame) {
+    RetinaFaceDetector detector;
+    InferenceContext context(net, 4);
+    std::vector<std::vector<FaceObject>> detections;
+    const auto start = std::chrono::steady_clock::now();
+    for (const cv::Mat& frame : frames) {
+        const RetinaFaceConfig& config = detector.config();
+        letterbox_to_blob(frame, config.target_size, config.align, context.input);
+        detections.push_back(detector.detect(context.input, context));
+    }
+    ms_per_frame = frames.empty() ? 0 : elapsed_ms(start) / frames.size();
+    return detections;
+}
+
+FrameStats frame_stats(const std::vector<std::vector<FaceObject>>& detections,
+                       const std::vector<std::vector<FaceObject>>& reference, double ms_per_frame) {
+    FrameStats stats;
+    stats.ms_per_frame = ms_per_frame;
+    size_t expected = 0, found = 0;
+    for (size_t f = 0; f < detections.size(); ++f) {
+        stats.faces += detections[f].size();
+        for (const FaceObject& want : reference[f]) {
+            ++expected;
+            for (const FaceObject& got : detections[f]) {
+                const float inter = (want.rect & got.rect).area();
+                if (inter / (want.rect.area() + got.rect.area() - inter) >= 0.5f) {
+                    ++found;
+                    break;
+                }
+            }
+        }
+    }
+    stats.fp32_recall = expected ? static_cast<double>(found) / expected : 1;
+    return stats;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <faces_dir> [frames_dir] [match_threshold]\n";
+        return 1;
+    }
+    const fs::path faces_dir = argv[1];
+    const fs::path frames_dir = argc > 2 ? argv[2] : "";
+    const float threshold = argc > 3 ? std::stof(argv[3]) : 0.7f;
+
+    const std::vector<Face> faces = load_faces(faces_dir);
+    if (faces.size() < 2) {
+        std::cerr << "[report] error: need at least two crops under " << faces_dir << "/<person>/.\n";
+        return 1;
+    }
+    std::vector<cv::Mat> frames;
+    if (!frames_dir.empty()) {
+        for (const fs::path& path : images_under(frames_dir)) {
+            cv::Mat frame = cv::imread(path.string());
+            if (!frame.empty()) frames.push_back(frame);
+        }
+    }
+    std::cerr << "[report] info: " << faces.size() << " face crops, " << frames.size() << " frames.\n";
+
+    const Precision precisions[] = { Precision::FP32, Precision::FP16, Precision::INT8 };
+    std::vector<Embedding> reference_embeddings;
+    std::vector<std::vector<FaceObject>> reference_detections;
+    FaceStats reference_faces;
+
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << "## mobilefacenet, match threshold " << threshold << "\n\n";
+    std::cout << "| precision | ms/face | TAR | FAR | min cos vs fp32 | mean cos vs fp32 | threshold holds |\n";
+    std::cout << "|---|---|---|---|---|---|---|\n";
+    for (Precision requested : precisions) {
+        Precision precision = requested;
+        ncnn::Net net;
+        if (!load_net(net, "models/mobilefacenet/mobilefacenet", precision, 4) || precision != requested) {
+            if (requested == Precision::FP32) {
+                std::cerr << "[report] error: failed to load the fp32 mobilefacenet reference.\n";
+                return 1;
+            }
+            std::cerr << "[report] warning: mobilefacenet " << precision_name(requested) << " not available, skipped.\n";
+            continue;
+        }
+        double ms = 0;
+        std::vector<Embedding> embeddings = embed(net, faces, ms);
+        if (precision == Precision::FP32) reference_embeddings = embeddings;
+        const FaceStats stats = face_stats(faces, embeddings, reference_embeddings, ms, threshold);
+        if (precision == Precision::FP32) reference_faces = stats;
+        const bool holds = stats.tar >= reference_faces.tar - 0.01 && stats.far <= reference_faces.far + 0.001;
+        std::cout << "| " << precision_name(precision) << " | " << stats.ms_per_face << " | " << stats.tar << " | "
+                  << stats.far << " | " << stats.min_fp32_cosine << " | " << stats.mean_fp32_cosine << " | "
+                  << (holds ? "yes" : "no") << " |\n";
+    }
+
+    if (frames.empty()) return 0;
+    std::cout << "\n## retinaface\n\n";
+    std::cout << "| precision | ms/frame | faces | fp32 faces recalled |\n";
+    std::cout << "|---|---|---|---|\n";
+    for (Precision requested : precisions) {
+        Precision precision = requested;
+        ncnn::Net net;
+        if (!load_net(net, "models/retinaface/mnet.25-opt", precision, 4) || precision != requested) {
+            if (requested == Precision::FP32) {
+                std::cerr << "[report] error: failed to load the fp32 retinaface reference.\n";
+                return 1;
+            }
+            std::cerr << "[report] warning: retinaface " << precision_name(requested) << " not available, skipped.\n";
+            continue;
+        }
+        double ms = 0;
+        std::vector<std::vector<FaceObject>> detections = detect(net, frames, ms);
+        if (precision == Precision::FP32) reference_detections = detections;
+        const FrameStats stats = frame_stats(detections, reference_detections, ms);
+        std::cout << "| " << precision_name(precision) << " | " << stats.ms_per_frame << " | " << stats.faces << " | "
+                  << stats.fp32_recall << " |\n";
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# builds int8 variants of both networks with ncnn's table calibration.
+#
+# usage: tools/quantize_models.sh [frames_dir] [faces_dir]
+#   frames_dir  camera frames for retinaface (default res/images)
+#   faces_dir   aligned 112x112 crops for mobilefacenet, as written by
+#               extract_faces (default res/faces)
+#
+# needs ncnn2table and ncnn2int8 from ncnn's tools/quantize on PATH, or
+# NCNN_TOOLS pointing at the directory holding them. writes
+# <model>-int8.param/.bin next to each model plus the .table used, which
+# the runtime picks up with SECURITY_VIEW_*_PRECISION=int8
+set -eu
+
+FRAMES_DIR=${1:-res/images}
+FACES_DIR=${2:-res/faces}
+TOOLS=${NCNN_TOOLS:+$NCNN_TOOLS/}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+list_images() {
+    find "$1" -type f \( -iname '*.png' -o -iname '*.jpg' -o -iname '*.jpeg' \) | sort > "$2"
+    count=$(wc -l < "$2")
+    if [ "$count" -eq 0 ]; then
+        echo "[quantize] error: no images under $1" >&2
+        exit 1
+    fi
+    echo "[quantize] info: $count calibration images from $1"
+}
+
+# model stem, image list, shape, then ncnn2table extras
+quantize() {
+    stem=$1
+    list=$2
+    shape=$3
+    # both networks take raw 0-255 rgb, as from_pixels(PIXEL_BGR2RGB) gives them
+    "${TOOLS}ncnn2table" "$stem.param" "$stem.bin" "$list" "$stem.table" \
+        mean=[0,0,0] norm=[1,1,1] shape="$shape" pixel=BGR2RGB thread="$(nproc)" method=kl
+    "${TOOLS}ncnn2int8" "$stem.param" "$stem.bin" "$stem-int8.param" "$stem-int8.bin" "$stem.table"
+    echo "[quantize] info: wrote $stem-int8.param/.bin"
+}
+
+# retinaface is calibrated on whole frames at the letterboxed input size the
+# detector sees for a 16:9 camera, mobilefacenet on the aligned crops it is fed
+list_images "$FRAMES_DIR" "$WORK/frames.txt"
+quantize models/retinaface/mnet.25-opt "$WORK/frames.txt" "[640,384,3]"
+
+list_images "$FACES_DIR" "$WORK/faces.txt"
+quantize models/mobilefacenet/mobilefacenet "$WORK/faces.txt" "[112,112,3]"
+
+echo "[quantize] info: check accuracy with build/tools/precision_report $FACES_DIR before deploying"